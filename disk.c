@@ -12,49 +12,597 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "disk.h"
 
+#ifndef _WIN32
+#   include <fcntl.h>
+#   include <pthread.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#endif
+
+//Exclusao mutua sobre o estado de um disco. DISK_LOCK protege a fila, o anel
+//assincrono e a posicao do FILE* no backend stdio; e' recursivo, para que
+//callbacks de conclusao possam usar a API. DISK_HEAD_LOCK protege o modelo
+//das cabecas (cilindro atual, relogio e estatisticas) e DISK_CACHE_LOCK a
+//cache de setores.
+//Nos backends posicionais (mmap e pio) a transferencia de dados ocorre fora
+//de DISK_LOCK, permitindo leitores concorrentes
+#ifndef _WIN32
+#   define DISK_LOCK(d) pthread_mutex_lock (&(d)->lock)
+#   define DISK_UNLOCK(d) pthread_mutex_unlock (&(d)->lock)
+#   define DISK_HEAD_LOCK(d) pthread_mutex_lock (&(d)->headLock)
+#   define DISK_HEAD_UNLOCK(d) pthread_mutex_unlock (&(d)->headLock)
+#   define DISK_CACHE_LOCK(d) pthread_mutex_lock (&(d)->cacheLock)
+#   define DISK_CACHE_UNLOCK(d) pthread_mutex_unlock (&(d)->cacheLock)
+#else
+#   define DISK_LOCK(d) do { } while (0)
+#   define DISK_UNLOCK(d) do { } while (0)
+#   define DISK_HEAD_LOCK(d) do { } while (0)
+#   define DISK_HEAD_UNLOCK(d) do { } while (0)
+#   define DISK_CACHE_LOCK(d) do { } while (0)
+#   define DISK_CACHE_UNLOCK(d) do { } while (0)
+#endif
+
 #define DISK_SEEKDELAY 10
+#define DISK_ROTATIONTIME 8333	//Tempo de uma rotacao (7200 rpm), em usec
 
 #define DISK_SECTORSPERTRACK 64
 #define DISK_SECTORDATAOFFSET 3
 #define DISK_SECTORTOTALSIZE (2*DISK_SECTORDATAOFFSET+DISK_SECTORDATASIZE)
+#define DISK_TRACKTOTALSIZE (DISK_SECTORSPERTRACK*DISK_SECTORTOTALSIZE)
 
 #define DISK_SECTORPREAMBLE " [["
 #define DISK_SECTORECC "]] "
 
+#define DISK_CACHEDEFAULTSIZE 256	//No. padrao de setores na cache
+#define DISK_QUEUEDEPTH 32		//No. maximo de pedidos pendentes
+#define DISK_CREATETRACKSPERWRITE 32	//Trilhas por escrita na criacao
+#define DISK_ASYNCRINGSIZE 64		//No. de entradas do anel de submissao
+
+//Entrada da cache de setores. Cada entrada guarda uma copia dos dados de um
+//setor e participa de uma lista de colisao (hash) e da lista LRU do disco
+typedef struct diskCacheEntry {
+	unsigned long addr;			//Endereco LBA do setor
+	unsigned char data[DISK_SECTORDATASIZE];//Copia dos dados do setor
+	struct diskCacheEntry *hashNext;	//Proxima entrada no bucket
+	struct diskCacheEntry *lruPrev;		//Entrada usada mais recentemente
+	struct diskCacheEntry *lruNext;		//Entrada usada menos recentemente
+} DiskCacheEntry;
+
+//Pedido de transferencia pendente na fila de escalonamento de um disco
+typedef struct diskRequest {
+	unsigned long addr;	//Endereco LBA do primeiro setor
+	DiskIOVec iov;		//Buffer e numero de setores do pedido
+	int write;		//0 para leitura, 1 para escrita
+	DiskIOCallback cb;	//Callback de conclusao (opcional)
+	void *cbArg;		//Argumento repassado ao callback
+} DiskRequest;
+
 //Estrutura para a representação de um disco fisico.
 //Seus membros etao protegidos, portanto use o tipo Disk e as funcoes externalizadas por disk.h.
 struct disk {
 	int id;				//Identificador do disco no sistema
 	FILE* fp;			//Arquivo que implementa o disco
+	int fd;				//Descritor de fp (backend pio)
 	unsigned long numCylinders;	//Numero de cilindros
 	unsigned long numSectors;	//Numero de setores
 	unsigned long size;		//Espaco util total para dados no disco
 	unsigned long currCylinder;	//Cilindro atual 
+	int backend;			//Backend de E/S (DISK_BACKEND_*)
+	unsigned char *map;		//Mapeamento do arquivo (backend mmap)
+	size_t mapSize;			//Tamanho do mapeamento, em bytes
+
+	DiskCacheEntry *cachePool;	//Entradas pre-alocadas da cache
+	DiskCacheEntry *cacheFree;	//Lista de entradas livres
+	DiskCacheEntry **cacheBuckets;	//Tabela hash indexada por endereco
+	DiskCacheEntry *lruHead;	//Entrada usada mais recentemente
+	DiskCacheEntry *lruTail;	//Entrada usada menos recentemente
+	unsigned long cacheSize;	//Capacidade da cache, em setores
+	unsigned long cacheMask;	//Mascara para indexar cacheBuckets
+	unsigned long cacheHits;	//Acessos atendidos pela cache
+	unsigned long cacheMisses;	//Acessos que foram ao disco
+
+	int schedPolicy;		//Politica de escalonamento (DISK_SCHED_*)
+	int schedUp;			//Sentido atual da varredura no SCAN
+	int queueLen;			//Numero de pedidos pendentes
+	DiskRequest queue[DISK_QUEUEDEPTH];	//Pedidos pendentes
+	unsigned long long doneLatency;	//Tempo de servico do pedido cujo
+					//callback executa (sob DISK_LOCK)
+	DiskStats stats;		//Estatisticas de E/S (sob headLock)
+
+	//Disco composto em faixas (backend striped)
+	Disk *members[DISK_STRIPEMAXMEMBERS]; //Discos membros, em ordem
+	int numMembers;			//Numero de membros
+	unsigned long stripeSectors;	//Setores por unidade de faixa
+
+	int timingMode;			//Modo de temporizacao (DISK_TIMING_*)
+	unsigned long long simTime;	//Relogio simulado do disco, em usec
+
+	DiskRequest ring[DISK_ASYNCRINGSIZE];	//Anel de submissao assincrona
+	int ringHead;			//Proxima entrada a ser consumida
+	int ringCount;			//Entradas ocupadas no anel
+	unsigned long asyncInflight;	//Pedidos submetidos e nao concluidos
+	int asyncFailed;		//Houve falha desde o ultimo diskAsyncWait
+#ifndef _WIN32
+	pthread_mutex_t lock;		//Protege o estado do disco (DISK_LOCK)
+	pthread_mutex_t headLock;	//Protege o modelo das cabecas
+	pthread_mutex_t cacheLock;	//Protege a cache de setores
+	pthread_mutex_t asyncLock;	//Protege o anel e os contadores acima
+	pthread_cond_t asyncCond;	//Novos pedidos ou encerramento (worker)
+	pthread_cond_t asyncDone;	//Conclusoes ou espaco livre no anel
+	pthread_t asyncThread;		//Thread que atende o anel
+	int asyncStarted;		//A thread do anel foi iniciada
+	int asyncStop;			//Pedido de encerramento da thread
+#endif
 };
 
+//Funcao interna que retira uma entrada da lista LRU
+void __diskCacheUnlink(Disk *d, DiskCacheEntry *e) {
+	if (e->lruPrev) e->lruPrev->lruNext = e->lruNext;
+	else d->lruHead = e->lruNext;
+	if (e->lruNext) e->lruNext->lruPrev = e->lruPrev;
+	else d->lruTail = e->lruPrev;
+	e->lruPrev = e->lruNext = NULL;
+}
 
-//Funcao interna, privada, para realizar o posicionamento
-//da cabeca sobre o setor desejado para leitura ou escrita
+//Funcao interna que coloca uma entrada no inicio (mais recente) da lista LRU
+void __diskCachePushFront(Disk *d, DiskCacheEntry *e) {
+	e->lruPrev = NULL;
+	e->lruNext = d->lruHead;
+	if (d->lruHead) d->lruHead->lruPrev = e;
+	d->lruHead = e;
+	if (!d->lruTail) d->lruTail = e;
+}
+
+//Funcao interna que procura um setor na cache. Retorna a entrada encontrada,
+//ja promovida a mais recente na lista LRU, ou NULL se o setor nao estiver
+//na cache
+DiskCacheEntry* __diskCacheLookup(Disk *d, unsigned long addr) {
+	DiskCacheEntry *e;
+	if (!d->cacheSize) return NULL;
+	for (e = d->cacheBuckets[addr & d->cacheMask]; e; e = e->hashNext)
+		if (e->addr == addr) {
+			if (e != d->lruHead) {
+				__diskCacheUnlink (d, e);
+				__diskCachePushFront (d, e);
+			}
+			return e;
+		}
+	return NULL;
+}
+
+//Funcao interna que guarda uma copia de um setor na cache, substituindo a
+//entrada usada menos recentemente se a cache estiver cheia
+void __diskCacheInsert(Disk *d, unsigned long addr, unsigned char *data) {
+	DiskCacheEntry *e, **pe;
+	if (!d->cacheSize) return;
+	e = __diskCacheLookup (d, addr);
+	if (!e) {
+		if (d->cacheFree) {
+			e = d->cacheFree;
+			d->cacheFree = e->hashNext;
+		}
+		else {
+			e = d->lruTail;
+			__diskCacheUnlink (d, e);
+			pe = &d->cacheBuckets[e->addr & d->cacheMask];
+			while (*pe != e) pe = &(*pe)->hashNext;
+			*pe = e->hashNext;
+		}
+		e->addr = addr;
+		e->hashNext = d->cacheBuckets[addr & d->cacheMask];
+		d->cacheBuckets[addr & d->cacheMask] = e;
+		__diskCachePushFront (d, e);
+	}
+	memcpy (e->data, data, DISK_SECTORDATASIZE);
+}
+
+
+//Funcao interna que desloca as cabecas ate o cilindro do setor addr
 //Insere um atraso a cada cilindro deslocado no percurso
-void __diskSeek(Disk *d, unsigned long addr) {
+void __diskMoveHead(Disk *d, unsigned long addr) {
 	unsigned long reqCyl, cylOffset;
-	unsigned long sectorPos = addr * DISK_SECTORTOTALSIZE;
-	unsigned long dataPos = sectorPos + DISK_SECTORDATAOFFSET;
 
  	diskAddrToCylinder (d, addr, &reqCyl);
 	cylOffset = (reqCyl < d->currCylinder 
                      ? d->currCylinder - reqCyl
 		     : reqCyl - d->currCylinder);
 
-	for (unsigned long i=1; i <= cylOffset; i++)
-		SLEEP (DISK_SEEKDELAY);
+	if (d->timingMode == DISK_TIMING_REAL) {
+		for (unsigned long i=1; i <= cylOffset; i++)
+			SLEEP (DISK_SEEKDELAY);
+		d->stats.sleptTime += (unsigned long long) cylOffset
+		                      * DISK_SEEKDELAY * 1000;
+	}
 
-	fseek (d->fp, dataPos, 0);
+	d->simTime += (unsigned long long) cylOffset * DISK_SEEKDELAY * 1000;
+	if (cylOffset) d->stats.seeks++;
+	d->stats.cylinders += cylOffset;
 	d->currCylinder = reqCyl;
 }
 
+//Funcao interna que avanca o relogio simulado pela latencia rotacional ate o
+//setor addr passar sob a cabeca e pelo tempo de transferencia de count
+//setores. A posicao angular do prato e' derivada do proprio relogio simulado
+void __diskChargeTransfer(Disk *d, unsigned long addr, unsigned long count) {
+	unsigned long long now = d->simTime % DISK_ROTATIONTIME;
+	unsigned long long target = (unsigned long long)
+		(addr % DISK_SECTORSPERTRACK) * DISK_ROTATIONTIME
+		/ DISK_SECTORSPERTRACK;
+	d->simTime += (target + DISK_ROTATIONTIME - now) % DISK_ROTATIONTIME;
+	d->simTime += (unsigned long long) count * DISK_ROTATIONTIME
+	              / DISK_SECTORSPERTRACK;
+}
+
+//Funcao interna que monta, em um buffer alocado, numTracks trilhas com a
+//formatacao de baixo nivel de um disco novo: delimitadores de setor e area de
+//dados preenchida com espacos. Retorna o buffer ou NULL se faltar memoria
+unsigned char* __diskBuildTracks(unsigned long numTracks) {
+	unsigned char *buf = malloc (numTracks * DISK_TRACKTOTALSIZE);
+	unsigned char *p = buf;
+	if (!buf) return NULL;
+	for (unsigned long j = 0; j < numTracks * DISK_SECTORSPERTRACK; j++) {
+		memcpy (p, DISK_SECTORPREAMBLE, DISK_SECTORDATAOFFSET);
+		memset (p + DISK_SECTORDATAOFFSET, ' ', DISK_SECTORDATASIZE);
+		memcpy (p + DISK_SECTORDATAOFFSET + DISK_SECTORDATASIZE,
+		        DISK_SECTORECC, DISK_SECTORDATAOFFSET);
+		p += DISK_SECTORTOTALSIZE;
+	}
+	return buf;
+}
+
+//Funcao interna que registra nas estatisticas uma operacao de leitura ou
+//escrita (write) de total setores com latencia lat, em usec. Deve ser
+//chamada sob DISK_HEAD_LOCK
+void __diskRecordOp(Disk *d, int write, unsigned long total,
+                    unsigned long long lat) {
+	int bucket = 0;
+	while (lat && bucket < DISK_STATS_LATBUCKETS - 1) {
+		lat >>= 1;
+		bucket++;
+	}
+	if (write) {
+		d->stats.writeOps++;
+		d->stats.sectorsWritten += total;
+	}
+	else {
+		d->stats.readOps++;
+		d->stats.sectorsRead += total;
+	}
+	d->stats.latency[write ? DISK_IO_WRITE : DISK_IO_READ][bucket]++;
+}
+
+//Funcao interna que contabiliza o atendimento de um trecho de total setores
+//contiguos a partir de addr: seek ate o primeiro setor, latencia rotacional,
+//transferencia e deslocamento ate o cilindro do ultimo setor. O trecho
+//detem as cabecas de forma exclusiva durante toda a contabilizacao; pedidos
+//de threads distintas sao atendidos pelas cabecas na ordem em que obtem
+//DISK_HEAD_LOCK, partindo sempre da posicao deixada pelo pedido anterior.
+//A operacao e' registrada nas estatisticas com o tempo simulado consumido,
+//que tambem e' retornado
+unsigned long long __diskServiceHead(Disk *d, unsigned long addr,
+                                     unsigned long total, int write) {
+	unsigned long long lat;
+	DISK_HEAD_LOCK (d);
+	lat = d->simTime;
+	__diskMoveHead (d, addr);
+	__diskChargeTransfer (d, addr, total);
+	__diskMoveHead (d, addr + total - 1);
+	lat = d->simTime - lat;
+	d->stats.busyTime += lat;
+	__diskRecordOp (d, write, total, lat);
+	DISK_HEAD_UNLOCK (d);
+	return lat;
+}
+
+//Funcao interna, privada, para realizar o posicionamento do arquivo do
+//disco sobre a area de dados do setor desejado para leitura ou escrita
+void __diskSeek(Disk *d, unsigned long addr) {
+	unsigned long sectorPos = addr * DISK_SECTORTOTALSIZE;
+	unsigned long dataPos = sectorPos + DISK_SECTORDATAOFFSET;
+
+	fseek (d->fp, dataPos, 0);
+}
+
+#ifndef _WIN32
+//Funcao interna que le ou escreve len bytes na posicao pos do arquivo do
+//disco com pread/pwrite, sem usar nem alterar a posicao corrente do arquivo.
+//Retorna 0 se todos os bytes foram transferidos ou -1 caso contrario
+int __diskPositionalIO(Disk *d, unsigned char *buf, size_t len, off_t pos,
+                       int write) {
+	while (len > 0) {
+		ssize_t n = (write ? pwrite (d->fd, buf, len, pos)
+		                   : pread (d->fd, buf, len, pos));
+		if (n <= 0) return -1;
+		buf += n;
+		pos += n;
+		len -= n;
+	}
+	return 0;
+}
+#endif
+
+//Funcao interna que transfere um trecho de total setores contiguos pelo
+//arquivo do disco (backends stdio e pio). O trecho e' percorrido com uma
+//unica chamada de leitura ou escrita, incluindo os delimitadores dos setores
+//intermediarios. Retorna 0 se bem sucedido ou -1 caso contrario
+int __diskFileTransfer(Disk *d, unsigned long addr, unsigned long total,
+                       DiskIOVec *iov, int iovcnt, int write) {
+	unsigned long span, k, s;
+	unsigned char *raw, *p;
+	int v, ret = 0;
+
+	span = (total - 1) * DISK_SECTORTOTALSIZE + DISK_SECTORDATASIZE;
+	if (iovcnt == 1 && total == 1) raw = iov[0].data;
+	else {
+		raw = malloc (span);
+		if (!raw) return -1;
+	}
+
+	if (write && raw != iov[0].data)
+		for (v = 0, k = 0; v < iovcnt; v++)
+			for (s = 0; s < iov[v].numSectors; s++, k++) {
+				p = raw + k * DISK_SECTORTOTALSIZE;
+				memcpy (p, iov[v].data + s*DISK_SECTORDATASIZE,
+				        DISK_SECTORDATASIZE);
+				if (k < total - 1)
+					memcpy (p + DISK_SECTORDATASIZE,
+					        DISK_SECTORECC
+					        DISK_SECTORPREAMBLE,
+					        2 * DISK_SECTORDATAOFFSET);
+			}
+
+#ifndef _WIN32
+	if (d->backend == DISK_BACKEND_PIO)
+		ret = __diskPositionalIO (d, raw, span, (off_t) addr
+		                          * DISK_SECTORTOTALSIZE
+		                          + DISK_SECTORDATAOFFSET, write);
+	else
+#endif
+	{
+		__diskSeek (d, addr);
+		if (write) {
+			if (fwrite (raw, 1, span, d->fp) != span) ret = -1;
+		}
+		else if (fread (raw, 1, span, d->fp) != span) ret = -1;
+	}
+
+	if (ret == 0 && !write && raw != iov[0].data)
+		for (v = 0, k = 0; v < iovcnt; v++)
+			for (s = 0; s < iov[v].numSectors; s++, k++)
+				memcpy (iov[v].data + s * DISK_SECTORDATASIZE,
+				        raw + k * DISK_SECTORTOTALSIZE,
+				        DISK_SECTORDATASIZE);
+
+	if (raw != iov[0].data) free (raw);
+	return ret;
+}
+
+//Funcao interna que transfere um trecho de setores contiguos diretamente do
+//ou para o mapeamento em memoria do arquivo do disco (backend mmap). Apenas
+//a area de dados de cada setor e' tocada, preservando seus delimitadores
+int __diskMappedTransfer(Disk *d, unsigned long addr, DiskIOVec *iov,
+                         int iovcnt, int write) {
+	unsigned long k, s;
+	unsigned char *p, *m;
+	int v;
+
+	for (v = 0, k = addr; v < iovcnt; v++)
+		for (s = 0; s < iov[v].numSectors; s++, k++) {
+			p = iov[v].data + s * DISK_SECTORDATASIZE;
+			m = d->map + k * DISK_SECTORTOTALSIZE
+			    + DISK_SECTORDATAOFFSET;
+			if (write) memcpy (m, p, DISK_SECTORDATASIZE);
+			else memcpy (p, m, DISK_SECTORDATASIZE);
+		}
+	return 0;
+}
+
+//Andamento, em um membro, de uma transferencia em faixas
+typedef struct diskStripeState {
+	Disk *member;			//Membro que atende os trechos
+	int used;			//Algum trecho foi submetido ao membro
+	int failed;			//Algum trecho falhou
+	unsigned long long busy;	//Soma do tempo de servico dos trechos
+} DiskStripeState;
+
+//Funcao interna chamada na conclusao de cada trecho de uma transferencia em
+//faixas. arg aponta para o andamento do membro que atendeu o trecho, ao qual
+//e' somado o tempo de servico do proprio trecho. Como cada membro conclui
+//seus pedidos em uma unica thread, o andamento nao e' disputado
+void __diskStripeDone(void *arg, int result) {
+	DiskStripeState *st = arg;
+	if (result < 0) st->failed = 1;
+	st->busy += st->member->doneLatency;
+}
+
+//Funcao interna que transfere total setores contiguos a partir de addr em
+//um disco composto em faixas. O trecho e' dividido em unidades de faixa,
+//cada uma submetida ao membro correspondente pelo seu anel assincrono, de
+//modo que os membros trabalham em paralelo. A latencia contabilizada no
+//disco composto e' a do membro com maior tempo de servico nos seus trechos,
+//medido pedido a pedido, sem contar trechos de outras transferencias
+//atendidos pelo mesmo membro. A latencia e' gravada em *lat. Retorna 0 se
+//bem sucedido ou -1 caso contrario
+int __diskStripedTransfer(Disk *d, unsigned long addr, unsigned long total,
+                          DiskIOVec *iov, int iovcnt, int write,
+                          unsigned long long *lat) {
+	DiskStripeState st[DISK_STRIPEMAXMEMBERS];
+	unsigned long unit, off, n, left;
+	unsigned char *p;
+	int v, m, ret = 0;
+
+	memset (st, 0, sizeof (st));
+	for (m = 0; m < d->numMembers; m++) st[m].member = d->members[m];
+	*lat = 0;
+	for (v = 0; v < iovcnt; v++)
+		for (p = iov[v].data, left = iov[v].numSectors; left; ) {
+			unit = addr / d->stripeSectors;
+			off = addr % d->stripeSectors;
+			m = unit % d->numMembers;
+			n = d->stripeSectors - off;
+			if (n > left) n = left;
+			if (diskAsyncSubmit (d->members[m], (write ? DISK_IO_WRITE
+			                                           : DISK_IO_READ),
+			                     unit / d->numMembers * d->stripeSectors
+			                     + off, n, p, __diskStripeDone,
+			                     &st[m]) < 0)
+				ret = -1;
+			else st[m].used = 1;
+			addr += n;
+			p += n * DISK_SECTORDATASIZE;
+			left -= n;
+		}
+	for (m = 0; m < d->numMembers; m++) {
+		if (!st[m].used) continue;
+		diskAsyncWait (d->members[m]);
+		if (st[m].failed) ret = -1;
+		if (st[m].busy > *lat) *lat = st[m].busy;
+	}
+
+	DISK_HEAD_LOCK (d);
+	d->simTime += *lat;
+	d->stats.busyTime += *lat;
+	__diskRecordOp (d, write, total, *lat);
+	DISK_HEAD_UNLOCK (d);
+	return ret;
+}
+
+//Funcao interna que transfere um trecho de setores contiguos, iniciado no
+//endereco LBA addr, entre o disco e os buffers de iov (write indica o
+//sentido), passando pela cache de setores e pelo backend do disco. Se lat
+//nao for NULL, recebe o tempo simulado de servico do trecho. Nos backends
+//stdio a chamada deve ocorrer sob DISK_LOCK. Retorna 0 se bem sucedido ou
+//-1 caso contrario
+int __diskTransfer(Disk *d, unsigned long addr, DiskIOVec *iov, int iovcnt,
+                   int write, unsigned long long *lat) {
+	unsigned long long service;
+	unsigned long total = 0, last, k, s;
+	DiskCacheEntry *e;
+	int v, ret;
+
+	if (lat) *lat = 0;
+	for (v = 0; v < iovcnt; v++) total += iov[v].numSectors;
+	if (total == 0) return 0;
+	if (addr >= d->numSectors || total > d->numSectors - addr) return -1;
+	last = addr + total - 1;
+
+	//Leitura atendida integralmente pela cache dispensa o acesso ao disco
+	if (!write && d->cacheSize) {
+		DISK_CACHE_LOCK (d);
+		for (k = addr; k <= last; k++)
+			if (!__diskCacheLookup (d, k)) break;
+		if (k > last) {
+			for (v = 0, k = addr; v < iovcnt; v++)
+				for (s = 0; s < iov[v].numSectors; s++, k++) {
+					e = __diskCacheLookup (d, k);
+					memcpy (iov[v].data + s*DISK_SECTORDATASIZE,
+					        e->data, DISK_SECTORDATASIZE);
+				}
+			d->cacheHits += total;
+			DISK_CACHE_UNLOCK (d);
+			DISK_HEAD_LOCK (d);
+			__diskRecordOp (d, 0, total, 0);
+			DISK_HEAD_UNLOCK (d);
+			return 0;
+		}
+		DISK_CACHE_UNLOCK (d);
+	}
+	if (!write) {
+		DISK_CACHE_LOCK (d);
+		d->cacheMisses += total;
+		DISK_CACHE_UNLOCK (d);
+	}
+
+	if (d->backend == DISK_BACKEND_STRIPED)
+		ret = __diskStripedTransfer (d, addr, total, iov, iovcnt,
+		                             write, &service);
+	else {
+		service = __diskServiceHead (d, addr, total, write);
+		if (d->backend == DISK_BACKEND_MMAP)
+			ret = __diskMappedTransfer (d, addr, iov, iovcnt,
+			                            write);
+		else ret = __diskFileTransfer (d, addr, total, iov, iovcnt,
+		                               write);
+	}
+
+	if (ret == 0 && d->cacheSize) {
+		DISK_CACHE_LOCK (d);
+		for (v = 0, k = addr; v < iovcnt; v++)
+			for (s = 0; s < iov[v].numSectors; s++, k++)
+				__diskCacheInsert (d, k, iov[v].data
+				                         + s*DISK_SECTORDATASIZE);
+		DISK_CACHE_UNLOCK (d);
+	}
+	if (lat) *lat = service;
+	return ret;
+}
+
+//Funcao interna que executa __diskTransfer a partir da API publica. No
+//backend stdio a transferencia ocorre sob DISK_LOCK, pois depende da posicao
+//compartilhada do FILE*; nos backends posicionais, apenas a cache e as
+//cabecas sao protegidas, e leituras de threads distintas prosseguem em
+//paralelo
+int __diskLockedTransfer(Disk *d, unsigned long addr, DiskIOVec *iov,
+                         int iovcnt, int write) {
+	int ret;
+	if (d->backend != DISK_BACKEND_STDIO)
+		return __diskTransfer (d, addr, iov, iovcnt, write, NULL);
+	DISK_LOCK (d);
+	ret = __diskTransfer (d, addr, iov, iovcnt, write, NULL);
+	DISK_UNLOCK (d);
+	return ret;
+}
+
+//Funcao interna que aloca e inicializa um Disk com numSectors setores de
+//dados para o backend indicado, sem arquivo associado, cache ou membros
+Disk* __diskAlloc(int id, int backend, unsigned long numSectors) {
+	Disk* d = malloc(sizeof (Disk));
+	d->id = id;
+	d->fp = NULL;
+	d->fd = -1;
+	d->numSectors = numSectors;
+	d->numCylinders = d->numSectors / DISK_SECTORSPERTRACK;
+	d->size = d->numSectors * DISK_SECTORDATASIZE;
+	d->currCylinder = 0;
+	d->backend = backend;
+	d->map = NULL;
+	d->mapSize = 0;
+	d->cachePool = NULL;
+	d->cacheBuckets = NULL;
+	d->cacheSize = 0;
+	d->schedPolicy = DISK_SCHED_FIFO;
+	d->schedUp = 1;
+	d->queueLen = 0;
+	d->doneLatency = 0;
+	memset (&d->stats, 0, sizeof (DiskStats));
+	d->numMembers = 0;
+	d->stripeSectors = 0;
+	d->timingMode = DISK_TIMING_REAL;
+	d->simTime = 0;
+	d->ringHead = 0;
+	d->ringCount = 0;
+	d->asyncInflight = 0;
+	d->asyncFailed = 0;
+#ifndef _WIN32
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+	pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init (&d->lock, &attr);
+	pthread_mutexattr_destroy (&attr);
+	pthread_mutex_init (&d->headLock, NULL);
+	pthread_mutex_init (&d->cacheLock, NULL);
+	pthread_mutex_init (&d->asyncLock, NULL);
+	pthread_cond_init (&d->asyncCond, NULL);
+	pthread_cond_init (&d->asyncDone, NULL);
+	d->asyncStarted = 0;
+	d->asyncStop = 0;
+#endif
+	return d;
+}
+
 //Funcao que conecta um disco fisico ao sistema operacional.
 //Um disco fisico eh implementado por meio de um arquivo regular, 
 //cujo caminho eh dado por rawDiskPath.
@@ -62,28 +610,171 @@ void __diskSeek(Disk *d, unsigned long addr) {
 //pelo sistema operacional. Se o disco existir, retorna um ponteiro para Disk.
 //Caso contrario, retorna NULL
 Disk* diskConnect(int id, char* rawDiskPath) {
+	return diskConnectBackend (id, rawDiskPath, DISK_BACKEND_STDIO);
+}
+
+//Funcao que conecta um disco fisico ao sistema operacional usando o backend
+//indicado (DISK_BACKEND_STDIO, DISK_BACKEND_MMAP ou DISK_BACKEND_PIO). No
+//backend mmap o arquivo do disco e' mapeado em memoria e a cache de setores
+//inicia desativada, ja que o proprio mapeamento dispensa chamadas de E/S. No
+//backend pio os setores sao lidos e escritos com pread/pwrite sobre o
+//descritor do arquivo, sem posicao compartilhada. Retorna um ponteiro para
+//Disk ou NULL se o disco nao existir ou o backend nao estiver disponivel
+Disk* diskConnectBackend(int id, char* rawDiskPath, int backend) {
 	Disk* d = NULL;
-	FILE *fp = fopen(rawDiskPath,"r+");
+	FILE *fp;
+	if (backend != DISK_BACKEND_STDIO && backend != DISK_BACKEND_MMAP &&
+	    backend != DISK_BACKEND_PIO)
+		return NULL;
+#ifdef _WIN32
+	if (backend != DISK_BACKEND_STDIO) return NULL;
+#endif
+	fp = fopen(rawDiskPath,"r+");
 	if (fp!=NULL) {
-		d = malloc(sizeof (Disk));
-		d->id = id;
-		d->fp = fp;
 		fseek (fp, 0, SEEK_END);
-		d->numSectors = ftell (fp) / DISK_SECTORTOTALSIZE;
-		d->numCylinders = d->numSectors / DISK_SECTORSPERTRACK;
-		d->size = d->numSectors * DISK_SECTORDATASIZE;
-		d->currCylinder = 0;
+		d = __diskAlloc (id, backend, ftell (fp) / DISK_SECTORTOTALSIZE);
+		d->fp = fp;
+		d->fd = fileno (fp);
+		if (backend == DISK_BACKEND_MMAP) {
+#ifndef _WIN32
+			d->mapSize = d->numSectors * DISK_SECTORTOTALSIZE;
+			if (d->mapSize > 0)
+				d->map = mmap (NULL, d->mapSize,
+				               PROT_READ | PROT_WRITE,
+				               MAP_SHARED, fileno (fp), 0);
+			if (d->map == MAP_FAILED) d->map = NULL;
+#endif
+			if (!d->map) {
+				diskDisconnect (d);
+				return NULL;
+			}
+		}
+		else diskSetCacheSize (d, DISK_CACHEDEFAULTSIZE);
 	}
 	return d;
 }
 
-//Funcao que disconecta um disco fisico do sistema operacional
+//Funcao que conecta ao sistema operacional um disco composto que distribui
+//seus setores em faixas (RAID-0) sobre numMembers discos ja conectados
+Disk* diskConnectStriped(int id, Disk** members, int numMembers,
+                         unsigned long stripeSectors) {
+	unsigned long memberSectors = 0;
+	Disk* d;
+	if (numMembers < 1 || numMembers > DISK_STRIPEMAXMEMBERS ||
+	    stripeSectors == 0)
+		return NULL;
+	for (int m = 0; m < numMembers; m++) {
+		if (!members[m]) return NULL;
+		for (int k = 0; k < m; k++)
+			if (members[k] == members[m]) return NULL;
+		if (m == 0 || members[m]->numSectors < memberSectors)
+			memberSectors = members[m]->numSectors;
+	}
+	memberSectors -= memberSectors % stripeSectors;
+	if (memberSectors == 0) return NULL;
+
+	d = __diskAlloc (id, DISK_BACKEND_STRIPED, memberSectors * numMembers);
+	for (int m = 0; m < numMembers; m++)
+		d->members[m] = members[m];
+	d->numMembers = numMembers;
+	d->stripeSectors = stripeSectors;
+	return d;
+}
+
+//Funcao que retorna o numero de membros de um disco composto em faixas, ou
+//0 se o disco nao for composto
+int diskGetNumMembers (Disk* d) {
+	return d->numMembers;
+}
+
+//Funcao que retorna o membro de indice i de um disco composto em faixas, ou
+//NULL se i for invalido
+Disk* diskGetMember (Disk* d, int i) {
+	if (i < 0 || i >= d->numMembers) return NULL;
+	return d->members[i];
+}
+
+//Funcao que retorna o numero de setores por unidade de faixa de um disco
+//composto, ou 0 se o disco nao for composto
+unsigned long diskGetStripeSectors (Disk* d) {
+	return d->stripeSectors;
+}
+
+//Funcao que disconecta um disco fisico do sistema operacional. Pedidos ainda
+//enfileirados sao atendidos antes. Os membros de um disco composto nao sao
+//desconectados, apenas descarregados
 int diskDisconnect(Disk* d) {
-	int result = fclose (d->fp);
+	int result = 0;
+#ifndef _WIN32
+	if (d->asyncStarted) {
+		if (diskAsyncWait (d) < 0) result = -1;
+		pthread_mutex_lock (&d->asyncLock);
+		d->asyncStop = 1;
+		pthread_cond_signal (&d->asyncCond);
+		pthread_mutex_unlock (&d->asyncLock);
+		pthread_join (d->asyncThread, NULL);
+	}
+#endif
+	if (diskDispatch (d) < 0) result = -1;
+#ifndef _WIN32
+	if (d->map) {
+		if (msync (d->map, d->mapSize, MS_SYNC) != 0) result = -1;
+		munmap (d->map, d->mapSize);
+	}
+#endif
+	if (d->fp && fclose (d->fp) != 0) result = -1;
+	for (int m = 0; m < d->numMembers; m++)
+		if (diskFlush (d->members[m]) < 0) result = -1;
+	diskSetCacheSize (d, 0);
+#ifndef _WIN32
+	pthread_mutex_destroy (&d->lock);
+	pthread_mutex_destroy (&d->headLock);
+	pthread_mutex_destroy (&d->cacheLock);
+	pthread_mutex_destroy (&d->asyncLock);
+	pthread_cond_destroy (&d->asyncCond);
+	pthread_cond_destroy (&d->asyncDone);
+#endif
 	free(d);
 	return result;
 }
 
+//Funcao que retorna o backend de E/S de um disco (DISK_BACKEND_*)
+int diskGetBackend (Disk* d) {
+	return d->backend;
+}
+
+//Funcao que retorna um ponteiro para a area de dados do setor addr dentro do
+//mapeamento de um disco conectado com o backend mmap, permitindo leitura sem
+//copia. O ponteiro deve ser usado apenas para leitura e e' valido ate a
+//desconexao do disco. O posicionamento e a transferencia sao contabilizados
+//como em uma leitura. Retorna NULL se addr for invalido ou o disco nao usar
+//o backend mmap
+unsigned char* diskMapSector (Disk* d, unsigned long addr) {
+	if (!d->map || addr >= d->numSectors) return NULL;
+	__diskServiceHead (d, addr, 1, 0);
+	return d->map + addr * DISK_SECTORTOTALSIZE + DISK_SECTORDATAOFFSET;
+}
+
+//Funcao que forca a gravacao no arquivo do disco de dados ainda mantidos
+//em buffers do sistema (fflush no backend stdio, msync no backend mmap).
+//Retorna 0 se bem sucedido ou -1 caso contrario
+int diskFlush (Disk* d) {
+	int ret;
+	DISK_LOCK (d);
+#ifndef _WIN32
+	if (d->map) ret = (msync (d->map, d->mapSize, MS_SYNC) == 0 ? 0 : -1);
+	else
+#endif
+	if (d->fp) ret = (fflush (d->fp) == 0 ? 0 : -1);
+	else {
+		ret = 0;
+		for (int m = 0; m < d->numMembers; m++)
+			if (diskFlush (d->members[m]) < 0) ret = -1;
+	}
+	DISK_UNLOCK (d);
+	return ret;
+}
+
 //Funcao que retorna o identificador de um disco fisico, conforme atribuido
 //pelo sistema operacional no momento da conexao
 int diskGetId (Disk* d) {
@@ -124,22 +815,113 @@ int diskAddrToCylinder (Disk* d, unsigned long addr, unsigned long *cyl) {
 //(addr). Os dados sao transferidos para *data. Retorna 0 se a leitura ocorreu
 //sem erros e -1 caso contrario
 int diskReadSector (Disk* d, unsigned long addr, unsigned char *data) {
-	if (addr >= d->numSectors) return -1;
-	__diskSeek (d,addr);
-	if (fread (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
-		return -1;
-	return 0;
+	DiskIOVec iov = { data, 1 };
+	return __diskLockedTransfer (d, addr, &iov, 1, 0);
 }
 
 //Funcao para realzar a escrita de um setor identificado pelo endereco LBA
 //(addr). Os dados sao transferidos a partir de *data. Retorna 0 se a leitura
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long addr, unsigned char* data) {
-	if (addr >= d->numSectors) return -1;
-	__diskSeek (d,addr);
-	if (fwrite (data, 1, DISK_SECTORDATASIZE, d->fp) != DISK_SECTORDATASIZE)
-		return -1;
-	return 0;
+	DiskIOVec iov = { data, 1 };
+	return __diskLockedTransfer (d, addr, &iov, 1, 1);
+}
+
+//Funcao para realizar a leitura de count setores contiguos, a partir do
+//endereco LBA addr, com um unico posicionamento. Os dados sao transferidos
+//para *data, que deve comportar count*DISK_SECTORDATASIZE bytes. Retorna 0 se
+//a leitura ocorreu sem erros e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned long count,
+                     unsigned char* data) {
+	DiskIOVec iov = { data, count };
+	return __diskLockedTransfer (d, addr, &iov, 1, 0);
+}
+
+//Funcao para realizar a escrita de count setores contiguos, a partir do
+//endereco LBA addr, com um unico posicionamento. Os dados sao transferidos a
+//partir de *data. Retorna 0 se a escrita ocorreu sem erros e -1 caso
+//contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned long count,
+                      unsigned char* data) {
+	DiskIOVec iov = { data, count };
+	return __diskLockedTransfer (d, addr, &iov, 1, 1);
+}
+
+//Funcao para realizar a leitura de um trecho de setores contiguos, a partir
+//do endereco LBA addr, espalhando os dados pelos iovcnt buffers de iov, na
+//ordem em que aparecem. Retorna 0 se a leitura ocorreu sem erros e -1 caso
+//contrario
+int diskReadSectorsV (Disk* d, unsigned long addr, DiskIOVec* iov,
+                      int iovcnt) {
+	return __diskLockedTransfer (d, addr, iov, iovcnt, 0);
+}
+
+//Funcao para realizar a escrita de um trecho de setores contiguos, a partir
+//do endereco LBA addr, reunindo os dados dos iovcnt buffers de iov, na ordem
+//em que aparecem. Retorna 0 se a escrita ocorreu sem erros e -1 caso
+//contrario
+int diskWriteSectorsV (Disk* d, unsigned long addr, DiskIOVec* iov,
+                       int iovcnt) {
+	return __diskLockedTransfer (d, addr, iov, iovcnt, 1);
+}
+
+//Funcao que redimensiona a cache de setores de um disco para numSectors
+//setores. A cache opera em write-through, portanto seu conteudo pode ser
+//descartado a qualquer momento. numSectors igual a 0 desativa a cache.
+//Retorna 0 se bem sucedido ou -1 se nao houver memoria suficiente
+int diskSetCacheSize (Disk* d, unsigned long numSectors) {
+	unsigned long numBuckets = 1;
+	int ret = 0;
+	DISK_LOCK (d);
+	DISK_CACHE_LOCK (d);
+	free (d->cachePool);
+	free (d->cacheBuckets);
+	d->cachePool = NULL;
+	d->cacheBuckets = NULL;
+	d->cacheFree = NULL;
+	d->lruHead = d->lruTail = NULL;
+	d->cacheSize = 0;
+	d->cacheMask = 0;
+	d->cacheHits = 0;
+	d->cacheMisses = 0;
+	if (numSectors > 0) {
+		while (numBuckets < numSectors) numBuckets <<= 1;
+		d->cachePool = malloc (numSectors * sizeof (DiskCacheEntry));
+		d->cacheBuckets = calloc (numBuckets, sizeof (DiskCacheEntry*));
+		if (!d->cachePool || !d->cacheBuckets) {
+			free (d->cachePool);
+			free (d->cacheBuckets);
+			d->cachePool = NULL;
+			d->cacheBuckets = NULL;
+			ret = -1;
+		}
+		else {
+			for (unsigned long i = 0; i < numSectors; i++) {
+				d->cachePool[i].hashNext = d->cacheFree;
+				d->cacheFree = &d->cachePool[i];
+			}
+			d->cacheSize = numSectors;
+			d->cacheMask = numBuckets - 1;
+		}
+	}
+	DISK_CACHE_UNLOCK (d);
+	DISK_UNLOCK (d);
+	return ret;
+}
+
+//Funcao que retorna a capacidade da cache de setores de um disco, em setores
+unsigned long diskGetCacheSize (Disk* d) {
+	return d->cacheSize;
+}
+
+//Funcao que retorna o numero de leituras de setor atendidas pela cache
+unsigned long diskGetCacheHits (Disk* d) {
+	return d->cacheHits;
+}
+
+//Funcao que retorna o numero de leituras de setor que precisaram ir ao disco
+unsigned long diskGetCacheMisses (Disk* d) {
+	return d->cacheMisses;
 }
 
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
@@ -148,18 +930,422 @@ int diskWriteSector (Disk* d, unsigned long addr, unsigned char* data) {
 //caso contrario. O disco fisico ja eh criado com formatacao de baixo nivel
 int diskCreateRawDisk (char* rawDiskPath, unsigned long numCylinders) {
 	FILE* fp;
+	unsigned char *buf;
+	unsigned long n;
 	if (numCylinders == 0) return -1;
+	buf = __diskBuildTracks (DISK_CREATETRACKSPERWRITE);
+	if (buf == NULL) return -1;
 	fp = fopen (rawDiskPath, "w+");
-	if (fp == NULL) return -1;
-	for (unsigned long i = 0; i < numCylinders; i++) {
-		for (int j = 0; j < DISK_SECTORSPERTRACK; j++) {
-			fwrite(DISK_SECTORPREAMBLE,1,DISK_SECTORDATAOFFSET,fp);
-			for (int k = 0; k < DISK_SECTORDATASIZE; k++)
-				fwrite(" ",1,1,fp);
-			fwrite(DISK_SECTORECC,1,DISK_SECTORDATAOFFSET,fp);
+	if (fp == NULL) {
+		free (buf);
+		return -1;
+	}
+	for (unsigned long i = 0; i < numCylinders; i += n) {
+		n = numCylinders - i;
+		if (n > DISK_CREATETRACKSPERWRITE) n = DISK_CREATETRACKSPERWRITE;
+		if (fwrite (buf, DISK_TRACKTOTALSIZE, n, fp) != n) {
+			fclose (fp);
+			free (buf);
+			return -1;
+		}
+	}
+	free (buf);
+	return (fclose (fp) == 0 ? 0 : -1);
+}
+
+#ifndef _WIN32
+//Faixa de cilindros gravada por uma thread de diskCreateRawDiskParallel
+typedef struct diskCreateJob {
+	int fd;				//Descritor do arquivo do disco
+	unsigned char *buf;		//Modelo com DISK_CREATETRACKSPERWRITE trilhas
+	unsigned long from, to;		//Cilindros [from, to) a gravar
+	int result;			//0 se bem sucedido, -1 caso contrario
+} DiskCreateJob;
+
+//Funcao interna executada por cada thread de diskCreateRawDiskParallel.
+//Grava a faixa de cilindros do job com pwrite, sem compartilhar a posicao
+//do arquivo com as demais threads
+void* __diskCreateWorker(void *arg) {
+	DiskCreateJob *job = arg;
+	unsigned long n;
+	job->result = 0;
+	for (unsigned long i = job->from; i < job->to; i += n) {
+		size_t len;
+		char *p;
+		off_t pos = (off_t) i * DISK_TRACKTOTALSIZE;
+		n = job->to - i;
+		if (n > DISK_CREATETRACKSPERWRITE) n = DISK_CREATETRACKSPERWRITE;
+		len = n * DISK_TRACKTOTALSIZE;
+		p = (char*) job->buf;
+		while (len > 0) {
+			ssize_t w = pwrite (job->fd, p, len, pos);
+			if (w <= 0) {
+				job->result = -1;
+				return NULL;
+			}
+			p += w;
+			pos += w;
+			len -= w;
+		}
+	}
+	return NULL;
+}
+#endif
+
+//Funcao para a criacao de um disco fisico, com o mesmo resultado de
+//diskCreateRawDisk, usando numWriters threads que gravam faixas disjuntas de
+//cilindros em paralelo. O espaco do arquivo e' reservado antecipadamente
+//(posix_fallocate) quando o sistema de arquivos hospedeiro permitir. Em
+//plataformas sem suporte a threads POSIX, equivale a diskCreateRawDisk.
+//Retorna 0 se o disco fisico for criado com sucesso e -1 caso contrario
+int diskCreateRawDiskParallel (char* rawDiskPath, unsigned long numCylinders,
+                               int numWriters) {
+#ifdef _WIN32
+	return diskCreateRawDisk (rawDiskPath, numCylinders);
+#else
+	DiskCreateJob *jobs;
+	pthread_t *threads;
+	unsigned char *buf;
+	off_t size = (off_t) numCylinders * DISK_TRACKTOTALSIZE;
+	int fd, started = 0, result = 0;
+
+	if (numCylinders == 0 || numWriters < 1) return -1;
+	if ((unsigned long) numWriters > numCylinders) numWriters = numCylinders;
+	fd = open (rawDiskPath, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) return -1;
+	if (posix_fallocate (fd, 0, size) != 0 && ftruncate (fd, size) != 0) {
+		close (fd);
+		return -1;
+	}
+
+	buf = __diskBuildTracks (DISK_CREATETRACKSPERWRITE);
+	jobs = malloc (numWriters * sizeof (DiskCreateJob));
+	threads = malloc (numWriters * sizeof (pthread_t));
+	if (!buf || !jobs || !threads) result = -1;
+
+	for (int w = 0; result == 0 && w < numWriters; w++) {
+		jobs[w].fd = fd;
+		jobs[w].buf = buf;
+		jobs[w].from = numCylinders * w / numWriters;
+		jobs[w].to = numCylinders * (w + 1) / numWriters;
+		if (pthread_create (&threads[w], NULL, __diskCreateWorker,
+		                    &jobs[w]) != 0) {
+			result = -1;
+			break;
+		}
+		started++;
+	}
+	for (int w = 0; w < started; w++) {
+		pthread_join (threads[w], NULL);
+		if (jobs[w].result < 0) result = -1;
+	}
+
+	free (threads);
+	free (jobs);
+	free (buf);
+	if (close (fd) != 0) result = -1;
+	return result;
+#endif
+}
+
+//Funcao que atende todos os pedidos enfileirados em um disco, na ordem
+//definida pela politica de escalonamento. No SCAN as cabecas varrem o disco
+//no sentido atual ate o ultimo pedido pendente e entao invertem o sentido;
+//no C-LOOK a varredura e' sempre crescente, retornando ao menor cilindro
+//pendente ao fim. Callbacks de conclusao sao chamados a cada pedido
+//atendido. Retorna 0 se todos os pedidos foram bem sucedidos ou -1 caso
+//contrario
+int __diskDispatch(Disk *d) {
+	DiskRequest queue[DISK_QUEUEDEPTH];
+	int order[DISK_QUEUEDEPTH];
+	int n = d->queueLen, split = 0, ret = 0;
+	unsigned long cyl;
+
+	//A fila e' esvaziada antes do atendimento, pois callbacks podem
+	//enfileirar novos pedidos
+	memcpy (queue, d->queue, n * sizeof (DiskRequest));
+	d->queueLen = 0;
+
+	//Ordenacao estavel dos pedidos por endereco
+	for (int q = 0; q < n; q++) {
+		int j = q;
+		while (j > 0 && queue[order[j-1]].addr > queue[q].addr) {
+			order[j] = order[j-1];
+			j--;
 		}
-//		fflush(stdout);
+		order[j] = q;
+	}
+	while (split < n) {
+		diskAddrToCylinder (d, queue[order[split]].addr, &cyl);
+		if (cyl >= d->currCylinder) break;
+		split++;
 	}
-	fclose(fp);
+
+	for (int k = 0; k < n; k++) {
+		DiskRequest *r;
+		int result;
+		if (d->schedPolicy == DISK_SCHED_FIFO) r = &queue[k];
+		else if (d->schedPolicy == DISK_SCHED_CLOOK)
+			r = &queue[order[(split + k) % n]];
+		else if (d->schedUp)
+			r = &queue[order[split + k < n ? split + k : n - 1 - k]];
+		else
+			r = &queue[order[k < split ? split - 1 - k : k]];
+		result = __diskTransfer (d, r->addr, &r->iov, 1, r->write,
+		                         &d->doneLatency);
+		if (result < 0) ret = -1;
+		if (r->cb) r->cb (r->cbArg, result);
+	}
+	//Inversao do sentido do SCAN quando a varredura passou pelos dois lados
+	if (d->schedPolicy == DISK_SCHED_SCAN &&
+	    (d->schedUp ? split > 0 : split < n))
+		d->schedUp = !d->schedUp;
+
+	return ret;
+}
+
+//Funcao que seleciona a politica de escalonamento (DISK_SCHED_FIFO,
+//DISK_SCHED_SCAN ou DISK_SCHED_CLOOK) usada por diskDispatch para ordenar
+//os pedidos enfileirados. Pedidos pendentes sao despachados antes da troca.
+//Retorna 0 se bem sucedido ou -1 se a politica for invalida
+int diskSetScheduler (Disk* d, int policy) {
+	if (policy != DISK_SCHED_FIFO && policy != DISK_SCHED_SCAN &&
+	    policy != DISK_SCHED_CLOOK) return -1;
+	DISK_LOCK (d);
+	__diskDispatch (d);
+	d->schedPolicy = policy;
+	DISK_UNLOCK (d);
 	return 0;
 }
+
+//Funcao que retorna a politica de escalonamento em uso em um disco
+int diskGetScheduler (Disk* d) {
+	return d->schedPolicy;
+}
+
+//Funcao interna que verifica se um novo pedido conflita com algum pedido
+//pendente, isto e', se ambos acessam um mesmo setor e ao menos um deles e'
+//uma escrita. Pedidos conflitantes nao podem ser reordenados entre si
+int __diskQueueConflicts(Disk *d, unsigned long addr, unsigned long count,
+                         int write) {
+	for (int q = 0; q < d->queueLen; q++) {
+		DiskRequest *r = &d->queue[q];
+		if (!write && !r->write) continue;
+		if (addr < r->addr + r->iov.numSectors &&
+		    r->addr < addr + count) return 1;
+	}
+	return 0;
+}
+
+//Funcao interna que enfileira um pedido de transferencia. Se a fila estiver
+//cheia ou o pedido conflitar com algum pendente, a fila e' despachada antes
+int __diskEnqueue(Disk *d, DiskRequest *req) {
+	int ret = 0;
+	if (req->iov.numSectors == 0) return 0;
+	if (req->addr >= d->numSectors ||
+	    req->iov.numSectors > d->numSectors - req->addr) return -1;
+	if (d->queueLen == DISK_QUEUEDEPTH ||
+	    __diskQueueConflicts (d, req->addr, req->iov.numSectors,
+	                          req->write))
+		ret = __diskDispatch (d);
+	d->queue[d->queueLen++] = *req;
+	return ret;
+}
+
+//Funcao interna que monta um pedido sem callback e o enfileira sob exclusao
+//mutua
+int __diskQueue(Disk *d, unsigned long addr, unsigned long count,
+                unsigned char *data, int write) {
+	DiskRequest req = { addr, { data, count }, write, NULL, NULL };
+	int ret;
+	DISK_LOCK (d);
+	ret = __diskEnqueue (d, &req);
+	DISK_UNLOCK (d);
+	return ret;
+}
+
+//Funcao para enfileirar a leitura de count setores contiguos, a partir do
+//endereco LBA addr, para *data. A leitura so' e' garantida apos diskDispatch.
+//Retorna 0 se bem sucedido ou -1 caso contrario
+int diskQueueRead (Disk* d, unsigned long addr, unsigned long count,
+                   unsigned char* data) {
+	return __diskQueue (d, addr, count, data, 0);
+}
+
+//Funcao para enfileirar a escrita de count setores contiguos, a partir do
+//endereco LBA addr, com os dados de *data. A escrita so' e' garantida apos
+//diskDispatch. Retorna 0 se bem sucedido ou -1 caso contrario
+int diskQueueWrite (Disk* d, unsigned long addr, unsigned long count,
+                    unsigned char* data) {
+	return __diskQueue (d, addr, count, data, 1);
+}
+
+//Funcao que atende todos os pedidos enfileirados em um disco, na ordem
+//definida pela politica de escalonamento. Retorna 0 se todos os pedidos
+//foram bem sucedidos ou -1 caso contrario
+int diskDispatch (Disk* d) {
+	int ret;
+	DISK_LOCK (d);
+	ret = __diskDispatch (d);
+	DISK_UNLOCK (d);
+	return ret;
+}
+
+//Funcao que retorna o numero total de cilindros percorridos pelas cabecas
+//de um disco desde a sua conexao ou desde a ultima chamada a diskResetStats
+unsigned long diskGetCylindersTravelled (Disk* d) {
+	return d->stats.cylinders;
+}
+
+//Funcao que copia para stats as estatisticas de E/S de um disco
+void diskGetStats (Disk* d, DiskStats* stats) {
+	DISK_HEAD_LOCK (d);
+	*stats = d->stats;
+	DISK_HEAD_UNLOCK (d);
+	DISK_CACHE_LOCK (d);
+	stats->cacheHits = d->cacheHits;
+	stats->cacheMisses = d->cacheMisses;
+	DISK_CACHE_UNLOCK (d);
+}
+
+//Funcao que zera as estatisticas de E/S de um disco, incluindo os contadores
+//da cache. O relogio simulado nao e' alterado
+void diskResetStats (Disk* d) {
+	DISK_HEAD_LOCK (d);
+	memset (&d->stats, 0, sizeof (DiskStats));
+	DISK_HEAD_UNLOCK (d);
+	DISK_CACHE_LOCK (d);
+	d->cacheHits = 0;
+	d->cacheMisses = 0;
+	DISK_CACHE_UNLOCK (d);
+}
+
+//Funcao que seleciona o modo de temporizacao de um disco. Em
+//DISK_TIMING_REAL o deslocamento das cabecas provoca atrasos reais (SLEEP);
+//em DISK_TIMING_VIRTUAL nenhum atraso e' inserido e os custos de seek,
+//rotacao e transferencia sao apenas somados ao relogio simulado. Em um disco
+//composto, o modo e' aplicado tambem aos membros. Retorna 0 se bem sucedido
+//ou -1 se o modo for invalido
+int diskSetTimingMode (Disk* d, int mode) {
+	if (mode != DISK_TIMING_REAL && mode != DISK_TIMING_VIRTUAL) return -1;
+	d->timingMode = mode;
+	for (int m = 0; m < d->numMembers; m++)
+		diskSetTimingMode (d->members[m], mode);
+	return 0;
+}
+
+//Funcao que retorna o modo de temporizacao de um disco
+int diskGetTimingMode (Disk* d) {
+	return d->timingMode;
+}
+
+//Funcao que retorna o tempo simulado de servico de um disco, em
+//microssegundos, acumulado desde a sua conexao. O relogio e' mantido em
+//ambos os modos de temporizacao
+unsigned long long diskGetSimulatedTime (Disk* d) {
+	unsigned long long t;
+	DISK_HEAD_LOCK (d);
+	t = d->simTime;
+	DISK_HEAD_UNLOCK (d);
+	return t;
+}
+
+#ifndef _WIN32
+//Funcao interna executada pela thread assincrona de um disco. A cada rodada
+//retira todos os pedidos do anel de submissao, entrega-os a fila de
+//escalonamento e os despacha, de modo que o lote inteiro e' reordenado pela
+//politica do disco. Os callbacks sao chamados nesta thread
+void* __diskAsyncWorker(void *arg) {
+	Disk *d = arg;
+	DiskRequest batch[DISK_ASYNCRINGSIZE];
+	int n, failed;
+
+	pthread_mutex_lock (&d->asyncLock);
+	for (;;) {
+		while (d->ringCount == 0 && !d->asyncStop)
+			pthread_cond_wait (&d->asyncCond, &d->asyncLock);
+		if (d->ringCount == 0) break;
+		for (n = 0; d->ringCount > 0; n++, d->ringCount--) {
+			batch[n] = d->ring[d->ringHead];
+			d->ringHead = (d->ringHead + 1) % DISK_ASYNCRINGSIZE;
+		}
+		pthread_cond_broadcast (&d->asyncDone);
+		pthread_mutex_unlock (&d->asyncLock);
+
+		failed = 0;
+		DISK_LOCK (d);
+		for (int k = 0; k < n; k++)
+			if (__diskEnqueue (d, &batch[k]) < 0) failed = 1;
+		if (__diskDispatch (d) < 0) failed = 1;
+		DISK_UNLOCK (d);
+
+		pthread_mutex_lock (&d->asyncLock);
+		if (failed) d->asyncFailed = 1;
+		d->asyncInflight -= n;
+		pthread_cond_broadcast (&d->asyncDone);
+	}
+	pthread_mutex_unlock (&d->asyncLock);
+	return NULL;
+}
+#endif
+
+//Funcao para submeter de forma assincrona a leitura (op igual a
+//DISK_IO_READ) ou escrita (DISK_IO_WRITE) de count setores contiguos a partir
+//do endereco LBA addr, usando o buffer data. O pedido e' colocado no anel de
+//submissao do disco e atendido por uma thread propria, junto com os demais
+//pendentes, na ordem da politica de escalonamento. Ao fim, cb (se nao NULL)
+//e' chamado nessa thread com arg e o resultado (0 ou -1). O buffer deve
+//permanecer valido ate a conclusao, e os setores envolvidos nao devem ser
+//acessados por chamadas sincronas antes dela. Bloqueia se o anel estiver
+//cheio. Retorna 0 se o pedido foi aceito ou -1 caso contrario
+int diskAsyncSubmit (Disk* d, int op, unsigned long addr, unsigned long count,
+                     unsigned char* data, DiskIOCallback cb, void* arg) {
+	DiskRequest req = { addr, { data, count }, op == DISK_IO_WRITE, cb, arg };
+	if (op != DISK_IO_READ && op != DISK_IO_WRITE) return -1;
+	if (addr >= d->numSectors || count > d->numSectors - addr) return -1;
+#ifdef _WIN32
+	//Sem threads POSIX, o pedido e' atendido imediatamente
+	int result = __diskTransfer (d, addr, &req.iov, 1, req.write,
+	                             &d->doneLatency);
+	if (result < 0) d->asyncFailed = 1;
+	if (cb) cb (arg, result);
+	return 0;
+#else
+	pthread_mutex_lock (&d->asyncLock);
+	if (!d->asyncStarted) {
+		if (pthread_create (&d->asyncThread, NULL, __diskAsyncWorker,
+		                    d) != 0) {
+			pthread_mutex_unlock (&d->asyncLock);
+			return -1;
+		}
+		d->asyncStarted = 1;
+	}
+	while (d->ringCount == DISK_ASYNCRINGSIZE)
+		pthread_cond_wait (&d->asyncDone, &d->asyncLock);
+	d->ring[(d->ringHead + d->ringCount) % DISK_ASYNCRINGSIZE] = req;
+	d->ringCount++;
+	d->asyncInflight++;
+	pthread_cond_signal (&d->asyncCond);
+	pthread_mutex_unlock (&d->asyncLock);
+	return 0;
+#endif
+}
+
+//Funcao que bloqueia ate a conclusao de todos os pedidos assincronos ja
+//submetidos a um disco. Nao deve ser chamada de dentro de um callback.
+//Retorna 0 se todos foram bem sucedidos desde a ultima espera ou -1 caso
+//contrario
+int diskAsyncWait (Disk* d) {
+	int ret;
+#ifndef _WIN32
+	pthread_mutex_lock (&d->asyncLock);
+	while (d->asyncInflight > 0)
+		pthread_cond_wait (&d->asyncDone, &d->asyncLock);
+#endif
+	ret = (d->asyncFailed ? -1 : 0);
+	d->asyncFailed = 0;
+#ifndef _WIN32
+	pthread_mutex_unlock (&d->asyncLock);
+#endif
+	return ret;
+}
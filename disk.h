@@ -32,9 +32,64 @@
 //Tamanho padrao do setor de qualquer disco, em bytes
 #define DISK_SECTORDATASIZE 512
 
+//Politicas de escalonamento da fila de pedidos de um disco
+#define DISK_SCHED_FIFO 0	//Ordem de submissao
+#define DISK_SCHED_SCAN 1	//Elevador: varredura nos dois sentidos
+#define DISK_SCHED_CLOOK 2	//Varredura circular, sempre crescente
+
+//Backends de E/S sobre o arquivo que implementa um disco
+#define DISK_BACKEND_STDIO 0	//fseek/fread/fwrite sobre FILE*
+#define DISK_BACKEND_MMAP 1	//Arquivo mapeado em memoria (mmap)
+#define DISK_BACKEND_PIO 2	//E/S posicional (pread/pwrite)
+#define DISK_BACKEND_STRIPED 3	//Composto em faixas sobre outros discos
+
+//Numero maximo de membros de um disco composto em faixas
+#define DISK_STRIPEMAXMEMBERS 16
+
+//Modos de temporizacao de um disco
+#define DISK_TIMING_REAL 0	//Atrasos de seek reais, via SLEEP
+#define DISK_TIMING_VIRTUAL 1	//Atrasos apenas no relogio simulado
+
 //Tipo de dados para a representacao de discos fisicos
 typedef struct disk Disk;
 
+//Tipo para descrever um dos buffers de uma transferencia vetorizada
+//(scatter-gather) de setores contiguos
+typedef struct disk_iovec {
+	unsigned char *data;		//Buffer com numSectors setores de dados
+	unsigned long numSectors;	//Numero de setores do buffer
+} DiskIOVec;
+
+//Operacoes de E/S assincrona
+#define DISK_IO_READ 0
+#define DISK_IO_WRITE 1
+
+//Tipo de callback chamado na conclusao de um pedido assincrono, recebendo o
+//argumento informado na submissao e o resultado (0 ou -1)
+typedef void (*DiskIOCallback) (void *arg, int result);
+
+//Numero de faixas dos histogramas de latencia de DiskStats. A faixa 0 conta
+//as operacoes atendidas sem tempo de disco (cache); a faixa i > 0 conta as de
+//latencia simulada entre 2^(i-1) e 2^i - 1 usec; a ultima acumula as maiores
+#define DISK_STATS_LATBUCKETS 32
+
+//Tipo com as estatisticas de E/S de um disco, acumuladas desde a conexao ou
+//desde a ultima chamada a diskResetStats
+typedef struct disk_stats {
+	unsigned long long readOps;	//Operacoes de leitura atendidas
+	unsigned long long writeOps;	//Operacoes de escrita atendidas
+	unsigned long long sectorsRead;	//Setores lidos pelos clientes
+	unsigned long long sectorsWritten; //Setores escritos pelos clientes
+	unsigned long long seeks;	//Deslocamentos das cabecas
+	unsigned long long cylinders;	//Cilindros percorridos nos seeks
+	unsigned long long busyTime;	//Tempo simulado de servico, em usec
+	unsigned long long sleptTime;	//Atraso real inserido, em usec
+	unsigned long long cacheHits;	//Setores lidos atendidos pela cache
+	unsigned long long cacheMisses;	//Setores lidos que foram ao disco
+	unsigned long long latency[2][DISK_STATS_LATBUCKETS]; //Histogramas,
+					//indexados por DISK_IO_READ/WRITE
+} DiskStats;
+
 //Funcao que conecta um disco fisico ao sistema operacional.
 //Um disco fisico eh implementado por meio de um arquivo regular, 
 //cujo caminho eh dado por rawDiskPath.
@@ -43,9 +98,64 @@ typedef struct disk Disk;
 //Caso contrario, retorna NULL
 Disk* diskConnect(int id, char* diskFilePath);
 
-//Funcao que disconecta um disco fisico do sistema operacional
+//Funcao que conecta um disco fisico ao sistema operacional usando o backend
+//indicado (DISK_BACKEND_STDIO, DISK_BACKEND_MMAP ou DISK_BACKEND_PIO). No
+//backend mmap o arquivo do disco e' mapeado em memoria e a cache de setores
+//inicia desativada. Nos backends posicionais (mmap e pio), leituras de
+//threads distintas sao atendidas em paralelo, sem lock global; somente a
+//contabilizacao das cabecas e a cache sao serializadas. O modelo das cabecas
+//e' unico por disco: cada transferencia as detem durante sua contabilizacao
+//(seek, rotacao e transferencia) e parte da posicao deixada pela anterior.
+//Escritas em um setor nao devem concorrer com outros acessos ao mesmo setor.
+//Retorna um ponteiro para Disk ou NULL se o disco nao existir ou o backend
+//nao estiver disponivel
+Disk* diskConnectBackend(int id, char* rawDiskPath, int backend);
+
+//Funcao que conecta ao sistema operacional um disco composto (RAID-0) que
+//distribui seus setores em faixas de stripeSectors setores, alternadamente,
+//sobre os numMembers discos em members (no maximo DISK_STRIPEMAXMEMBERS,
+//todos distintos e ja conectados). A unidade de faixa u fica no membro
+//u % numMembers. A capacidade e' a do menor membro, arredondada para baixo
+//em unidades de faixa, vezes numMembers. Os trechos de cada transferencia
+//sao atendidos pelos membros em paralelo. O disco composto inicia sem cache
+//propria e pode ser usado como qualquer outro disco; os membros nao devem
+//ser acessados diretamente nem desconectados antes dele. Retorna um
+//ponteiro para Disk ou NULL se os parametros forem invalidos
+Disk* diskConnectStriped(int id, Disk** members, int numMembers,
+                         unsigned long stripeSectors);
+
+//Funcao que retorna o numero de membros de um disco composto em faixas, ou
+//0 se o disco nao for composto
+int diskGetNumMembers (Disk* d);
+
+//Funcao que retorna o membro de indice i de um disco composto em faixas, ou
+//NULL se i for invalido
+Disk* diskGetMember (Disk* d, int i);
+
+//Funcao que retorna o numero de setores por unidade de faixa de um disco
+//composto, ou 0 se o disco nao for composto
+unsigned long diskGetStripeSectors (Disk* d);
+
+//Funcao que disconecta um disco fisico do sistema operacional, atendendo
+//antes os pedidos ainda enfileirados. Os membros de um disco composto nao sao
+//desconectados. Retorna 0 se bem sucedido ou -1 caso contrario
 int diskDisconnect(Disk* d);
 
+//Funcao que retorna o backend de E/S de um disco (DISK_BACKEND_*)
+int diskGetBackend (Disk* d);
+
+//Funcao que retorna um ponteiro para a area de dados do setor addr dentro do
+//mapeamento de um disco conectado com o backend mmap, permitindo leitura sem
+//copia. O ponteiro deve ser usado apenas para leitura e e' valido ate a
+//desconexao do disco. Retorna NULL se addr for invalido ou o disco nao usar
+//o backend mmap
+unsigned char* diskMapSector (Disk* d, unsigned long addr);
+
+//Funcao que forca a gravacao no arquivo do disco de dados ainda mantidos
+//em buffers do sistema (fflush no backend stdio, msync no backend mmap).
+//Retorna 0 se bem sucedido ou -1 caso contrario
+int diskFlush (Disk* d);
+
 //Funcao que retorna o identificador de um disco fisico, conforme atribuido
 //pelo sistema operacional no momento da conexao
 int diskGetId (Disk* d);
@@ -79,10 +189,136 @@ int diskReadSector (Disk* d, unsigned long addr, unsigned char* data);
 //ocorreu sem erros e -1 caso contrario
 int diskWriteSector (Disk* d, unsigned long int addr, unsigned char* data);
 
+//Funcao para realizar a leitura de count setores contiguos, a partir do
+//endereco LBA addr, com um unico posicionamento. Os dados sao transferidos
+//para *data, que deve comportar count*DISK_SECTORDATASIZE bytes. Retorna 0 se
+//a leitura ocorreu sem erros e -1 caso contrario
+int diskReadSectors (Disk* d, unsigned long addr, unsigned long count,
+                     unsigned char* data);
+
+//Funcao para realizar a escrita de count setores contiguos, a partir do
+//endereco LBA addr, com um unico posicionamento. Os dados sao transferidos a
+//partir de *data. Retorna 0 se a escrita ocorreu sem erros e -1 caso
+//contrario
+int diskWriteSectors (Disk* d, unsigned long addr, unsigned long count,
+                      unsigned char* data);
+
+//Funcao para realizar a leitura de um trecho de setores contiguos, a partir
+//do endereco LBA addr, espalhando os dados pelos iovcnt buffers de iov, na
+//ordem em que aparecem. Retorna 0 se a leitura ocorreu sem erros e -1 caso
+//contrario
+int diskReadSectorsV (Disk* d, unsigned long addr, DiskIOVec* iov,
+                      int iovcnt);
+
+//Funcao para realizar a escrita de um trecho de setores contiguos, a partir
+//do endereco LBA addr, reunindo os dados dos iovcnt buffers de iov, na ordem
+//em que aparecem. Retorna 0 se a escrita ocorreu sem erros e -1 caso
+//contrario
+int diskWriteSectorsV (Disk* d, unsigned long addr, DiskIOVec* iov,
+                       int iovcnt);
+
+//Funcao que redimensiona a cache LRU de setores de um disco para numSectors
+//setores. A cache opera em write-through, logo o arquivo do disco esta sempre
+//atualizado. numSectors igual a 0 desativa a cache. Retorna 0 se bem sucedido
+//ou -1 caso contrario
+int diskSetCacheSize (Disk* d, unsigned long numSectors);
+
+//Funcao que retorna a capacidade da cache de setores de um disco, em setores
+unsigned long diskGetCacheSize (Disk* d);
+
+//Funcao que retorna o numero de leituras de setor atendidas pela cache
+unsigned long diskGetCacheHits (Disk* d);
+
+//Funcao que retorna o numero de leituras de setor que precisaram ir ao disco
+unsigned long diskGetCacheMisses (Disk* d);
+
+//Funcao que seleciona a politica de escalonamento (DISK_SCHED_FIFO,
+//DISK_SCHED_SCAN ou DISK_SCHED_CLOOK) usada por diskDispatch para ordenar
+//os pedidos enfileirados. Pedidos pendentes sao despachados antes da troca.
+//Retorna 0 se bem sucedido ou -1 se a politica for invalida
+int diskSetScheduler (Disk* d, int policy);
+
+//Funcao que retorna a politica de escalonamento em uso em um disco
+int diskGetScheduler (Disk* d);
+
+//Funcao para enfileirar a leitura de count setores contiguos, a partir do
+//endereco LBA addr, para *data. A leitura so' e' garantida apos diskDispatch.
+//Retorna 0 se bem sucedido ou -1 caso contrario
+int diskQueueRead (Disk* d, unsigned long addr, unsigned long count,
+                   unsigned char* data);
+
+//Funcao para enfileirar a escrita de count setores contiguos, a partir do
+//endereco LBA addr, com os dados de *data. A escrita so' e' garantida apos
+//diskDispatch. Retorna 0 se bem sucedido ou -1 caso contrario
+int diskQueueWrite (Disk* d, unsigned long addr, unsigned long count,
+                    unsigned char* data);
+
+//Funcao que atende todos os pedidos enfileirados em um disco, na ordem
+//definida pela politica de escalonamento. Pedidos que acessam um mesmo setor,
+//sendo ao menos um deles escrita, sao sempre atendidos na ordem de submissao.
+//Retorna 0 se todos os pedidos foram bem sucedidos ou -1 caso contrario
+int diskDispatch (Disk* d);
+
+//Funcao que retorna o numero total de cilindros percorridos pelas cabecas
+//de um disco desde a sua conexao ou desde a ultima chamada a diskResetStats
+unsigned long diskGetCylindersTravelled (Disk* d);
+
+//Funcao que copia para stats as estatisticas de E/S de um disco. Cada
+//leitura ou escrita da API conta como uma operacao, com latencia igual ao
+//tempo simulado de seek, rotacao e transferencia; o acesso por
+//diskMapSector conta como leitura de um setor
+void diskGetStats (Disk* d, DiskStats* stats);
+
+//Funcao que zera as estatisticas de E/S de um disco, incluindo os contadores
+//da cache. O relogio simulado (diskGetSimulatedTime) nao e' alterado
+void diskResetStats (Disk* d);
+
+//Funcao que seleciona o modo de temporizacao de um disco. Em
+//DISK_TIMING_REAL o deslocamento das cabecas provoca atrasos reais (SLEEP);
+//em DISK_TIMING_VIRTUAL nenhum atraso e' inserido e os custos de seek,
+//rotacao e transferencia sao apenas somados ao relogio simulado. Em um disco
+//composto, o modo e' aplicado tambem aos membros. Retorna 0 se bem sucedido
+//ou -1 se o modo for invalido
+int diskSetTimingMode (Disk* d, int mode);
+
+//Funcao que retorna o modo de temporizacao de um disco
+int diskGetTimingMode (Disk* d);
+
+//Funcao que retorna o tempo simulado de servico de um disco, em
+//microssegundos, acumulado desde a sua conexao. O relogio e' mantido em
+//ambos os modos de temporizacao
+unsigned long long diskGetSimulatedTime (Disk* d);
+
+//Funcao para submeter de forma assincrona a leitura (op igual a
+//DISK_IO_READ) ou escrita (DISK_IO_WRITE) de count setores contiguos a partir
+//do endereco LBA addr, usando o buffer data. O pedido e' colocado no anel de
+//submissao do disco e atendido por uma thread propria, junto com os demais
+//pendentes, na ordem da politica de escalonamento. Ao fim, cb (se nao NULL)
+//e' chamado nessa thread com arg e o resultado (0 ou -1). O buffer deve
+//permanecer valido ate a conclusao, e os setores envolvidos nao devem ser
+//acessados por chamadas sincronas antes dela. Bloqueia se o anel estiver
+//cheio. Retorna 0 se o pedido foi aceito ou -1 caso contrario
+int diskAsyncSubmit (Disk* d, int op, unsigned long addr, unsigned long count,
+                     unsigned char* data, DiskIOCallback cb, void* arg);
+
+//Funcao que bloqueia ate a conclusao de todos os pedidos assincronos ja
+//submetidos a um disco. Nao deve ser chamada de dentro de um callback.
+//Retorna 0 se todos foram bem sucedidos desde a ultima espera ou -1 caso
+//contrario
+int diskAsyncWait (Disk* d);
+
 //Funcao para a criacao de um disco fisico, a ser representado pelo arquivo
 //regular indicado por rawDiskPath e com numero total de cilindros indicado
 //por numCylinders. Retorna 0 se o disco fisico for criado com sucesso e -1
 //caso contrario. O disco fisico ja eh criado com formatacao de baixo nivel
 int diskCreateRawDisk (char* rawDiskPath, unsigned long numCylinders);
 
+//Funcao para a criacao de um disco fisico, com o mesmo resultado de
+//diskCreateRawDisk, usando numWriters threads que gravam faixas disjuntas de
+//cilindros em paralelo. O espaco do arquivo e' reservado antecipadamente
+//(posix_fallocate) quando o sistema de arquivos hospedeiro permitir. Retorna
+//0 se o disco fisico for criado com sucesso e -1 caso contrario
+int diskCreateRawDiskParallel (char* rawDiskPath, unsigned long numCylinders,
+                               int numWriters);
+
 #endif
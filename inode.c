@@ -11,6 +11,8 @@
 */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include "inode.h"
 #include "util.h"
 
@@ -26,6 +28,19 @@
 #define INODE_ITEM_GROUPOWNER (INODE_SIZE - 5)	//Item 11: Grupo Proprietario
 #define INODE_ITEM_PERMISSION (INODE_SIZE - 4)	//Item 12: Permissao
 #define INODE_ITEM_REFCOUNT (INODE_SIZE - 3)	//Item 13: Contador referencia
+#define INODE_INLINE 0x80000000u	//Bit do tipo de arquivo: dados guardados
+					//nas posicoes de enderecos do i-node
+
+#define EXTENTS_PERHEAD (NUMBLOCKS_PERINODE / 2) //Extents no i-node principal
+#define EXTENTS_PEREXT (NUMITEMS_PERINODE / 2)	 //Extents por extensao
+#define INODE_MAXDISKS 16	//Discos com registros simultaneos (layout,
+				//mapa de i-nodes livres, gravacao adiada e
+				//tabela inicializada sob demanda)
+#define INODE_MAPMAXINODES (DISK_SECTORDATASIZE * 8) //Limite do mapa de livres
+#define INODE_MAPWORDS (INODE_MAPMAXINODES / 64)	//Palavras de 64 bits
+
+#define INODE_CACHESIZE 128	//Capacidade da cache de i-nodes
+#define INODE_CACHEBUCKETS 256	//Buckets da tabela hash (potencia de 2)
 
 //Tipo para representacao de i-nodes
 struct inode {
@@ -33,26 +48,768 @@ struct inode {
 	unsigned int number; 	//Numero do i-node
 	unsigned int next;	//Numero do proximo i-node em caso de extensao
 	Disk *d; 		//Disco ao qual pertence o i-node
+
+	//Campos da cache de i-nodes
+	int cached;		//1 se o i-node e' uma entrada da cache
+	unsigned int refs;	//Referencias obtidas por inodeGet
+	int dirty;		//Alterado em memoria e ainda nao salvo
+	Inode *hashNext;	//Proxima entrada no mesmo bucket
+	Inode *lruPrev;		//Vizinhos na lista LRU das entradas sem
+	Inode *lruNext;		//referencias, da mais para a menos recente
+	unsigned int *blockMap;	//Mapa de blocos da cadeia (NULL: nao montado)
+	unsigned int mapLen;	//Posicoes (ou extents) em blockMap
+	unsigned int tailNumber; //Ultimo i-node da cadeia (0: desconhecido)
+	unsigned int tailFill;	//Posicoes (ou extents) ocupadas no ultimo
+				//i-node da cadeia
 };
 
-//Funcao interna que retorna a ultima extensao de um i-node. Retorna NULL
-//se nao houver extensoes do i-node fornecido.
-Inode* __inodeGetLastExtension (Inode *i) {
-	unsigned int niNumber = 0;
-	Disk *d = i->d;
-	if (i->next) {
-		niNumber = i->next;
-		i = inodeLoad (niNumber, d);
-		if (!i) return NULL;
-	} 
-	else return NULL;
-	while (i->next != 0) {
-		niNumber = i->next;
-		free (i);
-		i = inodeLoad (niNumber, d);
-		if (!i) return NULL;
+//Tipo para o registro do layout de enderecamento usado em um disco
+typedef struct {
+	Disk *d;			//Disco (NULL: registro livre)
+	unsigned int sectorsPerBlock;	//Setores por bloco do disco
+} InodeLayout;
+
+//Discos cujos i-nodes usam o layout de extents. Os demais usam o layout
+//de enderecos de blocos
+static InodeLayout extentLayouts[INODE_MAXDISKS];
+
+//Tipo para o mapa de i-nodes livres de um disco, mantido em memoria. O bit
+//(n-1) indica se o i-node n esta' ocupado
+typedef struct {
+	Disk *d;			//Disco (NULL: registro livre)
+	unsigned int sector;		//Setor do mapa no disco
+	unsigned int numInodes;		//Numero de i-nodes do disco
+	unsigned int hint;		//Palavra onde a proxima busca comeca
+	int dirty;			//Alterado e ainda nao gravado
+	unsigned long long words[INODE_MAPWORDS]; //Bits, 64 por palavra
+} InodeFreeMap;
+
+static InodeFreeMap freeMaps[INODE_MAXDISKS];
+
+//Tipo para o registro de uma tabela de i-nodes inicializada sob demanda: so'
+//os primeiros initSectors setores da tabela foram gravados no disco, e os
+//demais sao tratados como vazios ate' a primeira gravacao
+typedef struct {
+	Disk *d;			//Disco (NULL: registro livre)
+	unsigned int initSectors;	//Setores inicializados (marca d'agua)
+	unsigned int numSectors;	//Setores da tabela de i-nodes
+	InodeTableInitSaver save;	//Persiste a marca (opcional)
+} InodeLazyTable;
+
+static InodeLazyTable lazyTables[INODE_MAXDISKS];
+
+//Discos cujos i-nodes tem gravacao adiada: alteracoes ficam na cache ate'
+//inodeCacheFlush ou o despejo da entrada
+static Disk *writeBackDisks[INODE_MAXDISKS];
+
+//Cache de i-nodes, indexada por (disco, numero do i-node). Entradas com
+//referencias nunca sao despejadas; as demais ficam na lista LRU e sao
+//reaproveitadas a partir da menos recente quando a cache esta' cheia
+static Inode *cacheBuckets[INODE_CACHEBUCKETS];
+static Inode *lruHead = NULL, *lruTail = NULL;
+static unsigned int cacheCount = 0;
+
+//Funcao interna que calcula o bucket da cache de um i-node
+unsigned int __inodeHash (unsigned int number, Disk *d) {
+	return (number * 2654435761u ^ (unsigned int) ((uintptr_t) d >> 4))
+	       & (INODE_CACHEBUCKETS - 1);
+}
+
+//Funcao interna que procura um i-node na cache. Retorna a entrada ou NULL
+Inode* __inodeCacheLookup (unsigned int number, Disk *d) {
+	Inode *e = cacheBuckets[__inodeHash (number, d)];
+	while (e && (e->number != number || e->d != d)) e = e->hashNext;
+	return e;
+}
+
+//Funcao interna que retira uma entrada da tabela hash da cache
+void __inodeCacheRemove (Inode *e) {
+	Inode **p = &cacheBuckets[__inodeHash (e->number, e->d)];
+	while (*p != e) p = &(*p)->hashNext;
+	*p = e->hashNext;
+	e->cached = 0;
+	cacheCount--;
+}
+
+//Funcao interna que retira uma entrada da lista LRU
+void __inodeLruUnlink (Inode *e) {
+	if (e->lruPrev) e->lruPrev->lruNext = e->lruNext;
+	else lruHead = e->lruNext;
+	if (e->lruNext) e->lruNext->lruPrev = e->lruPrev;
+	else lruTail = e->lruPrev;
+	e->lruPrev = e->lruNext = NULL;
+}
+
+//Funcao interna que coloca uma entrada no inicio (mais recente) da lista LRU
+void __inodeLruPushFront (Inode *e) {
+	e->lruPrev = NULL;
+	e->lruNext = lruHead;
+	if (lruHead) lruHead->lruPrev = e;
+	lruHead = e;
+	if (!lruTail) lruTail = e;
+}
+
+//Funcao interna que retorna o registro de layout de extents de um disco, ou
+//NULL se o disco usa o layout de enderecos de blocos
+InodeLayout* __inodeExtentLayout (Disk *d) {
+	for (int a = 0; a < INODE_MAXDISKS; a++)
+		if (extentLayouts[a].d == d) return &extentLayouts[a];
+	return NULL;
+}
+
+//Funcao interna que retorna o mapa de i-nodes livres de um disco, ou NULL
+//se nenhum mapa estiver associado ao disco
+InodeFreeMap* __inodeFreeMapOf (Disk *d) {
+	for (int a = 0; a < INODE_MAXDISKS; a++)
+		if (freeMaps[a].d == d) return &freeMaps[a];
+	return NULL;
+}
+
+//Funcao interna que marca o i-node number como ocupado (used nao nulo) ou
+//livre no mapa de i-nodes livres de seu disco, se houver
+void __inodeMarkUsed (Disk *d, unsigned int number, int used) {
+	InodeFreeMap *m = __inodeFreeMapOf (d);
+	unsigned long long bit;
+	if (!m || number < 1 || number > m->numInodes) return;
+	bit = 1ULL << ((number - 1) % 64);
+	if (used) m->words[(number - 1) / 64] |= bit;
+	else m->words[(number - 1) / 64] &= ~bit;
+	m->dirty = 1;
+}
+
+//Funcao interna que retorna o indice do bit 0 menos significativo de uma
+//palavra que nao tem todos os bits em 1
+int __inodeFirstZeroBit (unsigned long long w) {
+#ifdef __GNUC__
+	return __builtin_ctzll (~w);
+#else
+	int b = 0;
+	while (w & 1) {
+		w >>= 1;
+		b++;
 	}
-	return i;
+	return b;
+#endif
+}
+
+//Funcao interna que grava o mapa de i-nodes livres m em seu setor, se ele
+//tiver sido alterado. Retorna 0 se bem sucedido ou -1 caso contrario
+int __inodeFreeMapSave (InodeFreeMap *m) {
+	unsigned char sector[DISK_SECTORDATASIZE];
+	if (!m->dirty) return 0;
+	for (int a = 0; a < DISK_SECTORDATASIZE; a++)
+		sector[a] = (unsigned char) (m->words[a / 8] >> (a % 8 * 8));
+	if (diskWriteSector (m->d, m->sector, sector) < 0) return -1;
+	m->dirty = 0;
+	return 0;
+}
+
+//Funcao interna que retorna o registro de tabela de i-nodes inicializada sob
+//demanda de um disco, ou NULL se a tabela do disco estiver toda inicializada
+InodeLazyTable* __inodeLazyTableOf (Disk *d) {
+	for (int a = 0; a < INODE_MAXDISKS; a++)
+		if (lazyTables[a].d == d) return &lazyTables[a];
+	return NULL;
+}
+
+//Funcao interna que preenche count setores a partir do setor idx da tabela
+//de i-nodes (0: primeiro setor) com i-nodes vazios, como na formatacao
+void __inodeBlankSectors (unsigned int idx, unsigned int count,
+                          unsigned char *buf) {
+	unsigned int perSector = inodeNumInodesPerSector ();
+	unsigned long int sizeUInt = sizeof(unsigned int);
+	memset (buf, 0, (unsigned long) count * DISK_SECTORDATASIZE);
+	for (unsigned int n = 0; n < count * perSector; n++)
+		ul2char (idx * perSector + n + 1,
+		         &buf[(n * INODE_SIZE + NUMITEMS_PERINODE) * sizeUInt]);
+}
+
+//Funcao interna que le o setor idx da tabela de i-nodes de um disco. Setores
+//alem da marca d'agua de uma tabela inicializada sob demanda sao montados em
+//memoria, sem leitura. Retorna 0 se bem sucedido ou -1 caso contrario
+int __inodeReadTableSector (Disk *d, unsigned int idx, unsigned char *sector) {
+	InodeLazyTable *t = __inodeLazyTableOf (d);
+	if (t && idx >= t->initSectors) {
+		__inodeBlankSectors (idx, 1, sector);
+		return 0;
+	}
+	return diskReadSector (d, INODE_BEGINSECTOR + idx, sector);
+}
+
+//Funcao interna que prepara a gravacao do setor idx da tabela de i-nodes de
+//um disco. Setores ainda nao inicializados entre a marca d'agua e idx sao
+//gravados vazios, de uma so' vez, e a marca passa para depois de idx. A
+//nova marca e' persistida antes de retornar, pois so' depois disso o setor
+//idx pode ser gravado. Retorna 0 se bem sucedido ou -1 caso contrario
+int __inodeTouchTableSector (Disk *d, unsigned int idx) {
+	InodeLazyTable *t = __inodeLazyTableOf (d);
+	unsigned char *gap;
+	if (!t || idx < t->initSectors) return 0;
+	if (idx > t->initSectors) {
+		unsigned int count = idx - t->initSectors;
+		gap = malloc ((unsigned long) count * DISK_SECTORDATASIZE);
+		if (!gap) return -1;
+		__inodeBlankSectors (t->initSectors, count, gap);
+		if (diskWriteSectors (d, INODE_BEGINSECTOR + t->initSectors,
+		                      count, gap) < 0) {
+			free (gap);
+			return -1;
+		}
+		free (gap);
+		t->initSectors = idx;
+	}
+	if (t->save && t->save (d, idx + 1) < 0) return -1;
+	t->initSectors = idx + 1;
+	return 0;
+}
+
+//Funcao interna que le do disco o i-node number para i, sem passar pela
+//cache. Retorna 0 se bem sucedido ou -1 caso contrario
+int __inodeRead (unsigned int number, Disk *d, Inode *i) {
+	unsigned long int sizeUInt = sizeof(unsigned int);
+	//Endereco do setor do qual o i-node sera' lido
+	unsigned long int inodeSectorAddr = 
+		INODE_BEGINSECTOR + (number - 1) * INODE_SIZE * sizeUInt
+		    / DISK_SECTORDATASIZE;
+	unsigned char sector[DISK_SECTORDATASIZE];
+
+	int ret = __inodeReadTableSector (d, inodeSectorAddr - INODE_BEGINSECTOR,
+	                                  sector);
+	if (ret < 0) return -1;
+
+	//Posicao de inicio do i-node dentro do setor
+	unsigned long int offset = ((number - 1) % 
+		(DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
+		* INODE_SIZE * sizeUInt;
+
+	unsigned int link[2];
+
+	i->d = d;
+	//Recuperando enderecos de blocos, atributos e encadeamento do i-node
+	char2uls (&sector[offset], i->inodeItem, NUMITEMS_PERINODE);
+	char2uls (&sector[offset+NUMITEMS_PERINODE*sizeUInt], link, 2);
+	i->number = link[0];
+	i->next = link[1];
+	return 0;
+}
+
+//Funcao interna que copia o conteudo persistente (enderecos, atributos e
+//encadeamento) do i-node src para dst
+void __inodeCopy (Inode *dst, Inode *src) {
+	for (int a = 0; a < NUMITEMS_PERINODE; a++)
+		dst->inodeItem[a] = src->inodeItem[a];
+	dst->number = src->number;
+	dst->next = src->next;
+	dst->d = src->d;
+}
+
+//Funcao interna que inicializa os campos de cache de um i-node fora da cache
+void __inodeInitUncached (Inode *i) {
+	i->cached = 0;
+	i->refs = 0;
+	i->dirty = 0;
+	i->hashNext = i->lruPrev = i->lruNext = NULL;
+	i->blockMap = NULL;
+	i->mapLen = 0;
+	i->tailNumber = 0;
+	i->tailFill = 0;
+}
+
+//Funcao interna que descarta o mapa de blocos de um i-node e o ultimo i-node
+//da cadeia memorizado, dados derivados da cadeia
+void __inodeDropMap (Inode *i) {
+	free (i->blockMap);
+	i->blockMap = NULL;
+	i->mapLen = 0;
+	i->tailNumber = 0;
+	i->tailFill = 0;
+}
+
+//Funcao interna que retorna o ultimo i-node da cadeia de i, que pode ser o
+//proprio i ou uma extensao obtida da cache (a ser liberada com inodePut), e
+//coloca em fill o numero de posicoes (ou extents, com extents nao nulo)
+//ocupadas nele. A cadeia so' e' percorrida quando o ultimo i-node ainda nao
+//estiver memorizado em i. Retorna NULL em caso de falha
+Inode* __inodeGetTail (Inode *i, int extents, unsigned int *fill) {
+	Inode *tail = i;
+	if (i->tailNumber == 0) {
+		int cap;
+		while (tail->next != 0) {
+			unsigned int niNumber = tail->next;
+			if (tail != i) inodePut (tail);
+			tail = inodeGet (niNumber, i->d);
+			if (!tail) return NULL;
+		}
+		if (extents) {
+			cap = (tail == i ? EXTENTS_PERHEAD : EXTENTS_PEREXT);
+			for (int a = 0; a < cap; a++)
+				if (tail->inodeItem[2*a+1]) i->tailFill = a + 1;
+		}
+		else {
+			cap = (tail == i ? NUMBLOCKS_PERINODE : NUMITEMS_PERINODE);
+			while (i->tailFill < (unsigned int) cap &&
+			       tail->inodeItem[i->tailFill] != 0)
+				i->tailFill++;
+		}
+		i->tailNumber = tail->number;
+	}
+	else if (i->tailNumber != i->number) {
+		tail = inodeGet (i->tailNumber, i->d);
+		if (!tail) return NULL;
+	}
+	*fill = i->tailFill;
+	return tail;
+}
+
+//Funcao interna que libera a memoria de um i-node fora da cache
+void __inodeFree (Inode *i) {
+	__inodeDropMap (i);
+	free (i);
+}
+
+//Funcao interna que monta o mapa de blocos de um i-node da cache, primeiro
+//de sua cadeia: um vetor com as posicoes de enderecos do proprio i-node
+//seguidas das de cada extensao, na ordem da cadeia, de modo que a posicao k
+//guarda o endereco do bloco logico k. A cadeia e' percorrida uma unica vez.
+//Retorna 0 se bem sucedido ou -1 caso contrario
+int __inodeBuildMap (Inode *i) {
+	unsigned int *map = malloc (NUMBLOCKS_PERINODE * sizeof (unsigned int));
+	unsigned int len = NUMBLOCKS_PERINODE, next = i->next;
+	if (!map) return -1;
+	for (int a = 0; a < NUMBLOCKS_PERINODE; a++)
+		map[a] = i->inodeItem[a];
+	while (next) {
+		Inode *ni = inodeGet (next, i->d);
+		unsigned int *grown = realloc (map, (len + NUMITEMS_PERINODE)
+		                                    * sizeof (unsigned int));
+		if (!ni || !grown) {
+			inodePut (ni);
+			free (grown ? grown : map);
+			return -1;
+		}
+		map = grown;
+		for (int a = 0; a < NUMITEMS_PERINODE; a++)
+			map[len + a] = ni->inodeItem[a];
+		len += NUMITEMS_PERINODE;
+		next = ni->next;
+		inodePut (ni);
+	}
+	free (i->blockMap);
+	i->blockMap = map;
+	i->mapLen = len;
+	return 0;
+}
+
+//Funcao interna que registra no mapa de blocos ja montado de um i-node o
+//endereco blockAddr na posicao pos, acrescentando ao mapa as posicoes de
+//uma nova extensao se pos estiver alem do fim. Em caso de falta de memoria,
+//o mapa e' descartado e sera' remontado na proxima consulta
+void __inodeMapSet (Inode *i, unsigned int pos, unsigned int blockAddr) {
+	if (!i->blockMap) return;
+	if (pos >= i->mapLen) {
+		unsigned int *grown = realloc (i->blockMap,
+		                               (i->mapLen + NUMITEMS_PERINODE)
+		                               * sizeof (unsigned int));
+		if (!grown) {
+			__inodeDropMap (i);
+			return;
+		}
+		for (int a = 0; a < NUMITEMS_PERINODE; a++)
+			grown[i->mapLen + a] = 0;
+		i->blockMap = grown;
+		i->mapLen += NUMITEMS_PERINODE;
+	}
+	i->blockMap[pos] = blockAddr;
+}
+
+//Funcao interna que monta o mapa de extents de um i-node da cache, primeiro
+//de sua cadeia, no layout de extents. Cada extent ocupado da cadeia gera uma
+//tripla (bloco logico inicial, endereco inicial, comprimento em blocos) em
+//blockMap, em ordem crescente de bloco logico; mapLen conta os extents.
+//Retorna 0 se bem sucedido ou -1 caso contrario
+int __inodeBuildExtentMap (Inode *i) {
+	unsigned int *map = malloc (3 * EXTENTS_PERHEAD * sizeof (unsigned int));
+	unsigned int len = 0, logical = 0, next = i->next;
+	Inode *ni = i;
+	int numExtents = EXTENTS_PERHEAD;
+	if (!map) return -1;
+	for (;;) {
+		for (int a = 0; a < numExtents; a++) {
+			unsigned int count = ni->inodeItem[2*a+1];
+			if (count == 0) continue;
+			map[3*len] = logical;
+			map[3*len+1] = ni->inodeItem[2*a];
+			map[3*len+2] = count;
+			logical += count;
+			len++;
+		}
+		if (ni != i) inodePut (ni);
+		if (!next) break;
+		unsigned int *grown = realloc (map, 3 * (len + EXTENTS_PEREXT)
+		                                    * sizeof (unsigned int));
+		ni = (grown ? inodeGet (next, i->d) : NULL);
+		if (grown) map = grown;
+		if (!ni) {
+			free (map);
+			return -1;
+		}
+		next = ni->next;
+		numExtents = EXTENTS_PEREXT;
+	}
+	free (i->blockMap);
+	i->blockMap = map;
+	i->mapLen = len;
+	return 0;
+}
+
+//Funcao interna que acrescenta ao mapa de extents ja montado de um i-node
+//um bloco no endereco blockAddr, estendendo o ultimo extent (extend nao
+//nulo) ou criando um novo. Em caso de falta de memoria, o mapa e'
+//descartado e sera' remontado na proxima consulta
+void __inodeExtentMapAppend (Inode *i, unsigned int blockAddr, int extend) {
+	unsigned int *m;
+	if (!i->blockMap) return;
+	if (extend && i->mapLen > 0) {
+		i->blockMap[3*(i->mapLen-1)+2]++;
+		return;
+	}
+	m = realloc (i->blockMap, 3 * (i->mapLen + 1) * sizeof (unsigned int));
+	if (!m) {
+		__inodeDropMap (i);
+		return;
+	}
+	m[3*i->mapLen] = (i->mapLen ? m[3*(i->mapLen-1)] + m[3*(i->mapLen-1)+2]
+	                            : 0);
+	m[3*i->mapLen+1] = blockAddr;
+	m[3*i->mapLen+2] = 1;
+	i->blockMap = m;
+	i->mapLen++;
+}
+
+//Funcao interna que retorna o endereco do bloco logico blockNum de um i-node
+//no layout de extents, com sectorsPerBlock setores por bloco. Em i-nodes da
+//cache, o extent e' localizado por busca binaria no mapa de extents; nas
+//copias, a cadeia e' percorrida. Retorna 0 se o bloco nao possuir endereco
+unsigned int __inodeExtentLookup (Inode *i, unsigned int blockNum,
+                                  unsigned int sectorsPerBlock) {
+	if (i->cached) {
+		unsigned int lo = 0, hi, *m;
+		if (!i->blockMap && __inodeBuildExtentMap (i) < 0) return 0;
+		m = i->blockMap;
+		hi = i->mapLen;
+		//Ultimo extent com bloco logico inicial <= blockNum
+		while (lo < hi) {
+			unsigned int mid = (lo + hi) / 2;
+			if (m[3*mid] <= blockNum) lo = mid + 1;
+			else hi = mid;
+		}
+		if (lo == 0 || blockNum - m[3*(lo-1)] >= m[3*(lo-1)+2]) return 0;
+		return m[3*(lo-1)+1] + (blockNum - m[3*(lo-1)]) * sectorsPerBlock;
+	}
+	else {
+		unsigned int logical = 0, next = i->next, addr = 0;
+		Inode *ni = i;
+		int numExtents = EXTENTS_PERHEAD, found = 0;
+		for (;;) {
+			for (int a = 0; a < numExtents && !found; a++) {
+				unsigned int count = ni->inodeItem[2*a+1];
+				if (blockNum < logical + count) {
+					addr = ni->inodeItem[2*a] + (blockNum - logical)
+					       * sectorsPerBlock;
+					found = 1;
+				}
+				logical += count;
+			}
+			if (ni != i) inodePut (ni);
+			if (found || !next) break;
+			ni = inodeGet (next, i->d);
+			if (!ni) break;
+			next = ni->next;
+			numExtents = EXTENTS_PEREXT;
+		}
+		return addr;
+	}
+}
+
+//Funcao interna que acrescenta o bloco de endereco blockAddr ao fim de um
+//i-node no layout de extents. Se o bloco for contiguo ao ultimo extent da
+//cadeia, apenas o comprimento do extent aumenta; caso contrario, um novo
+//extent e' criado no ultimo i-node da cadeia ou, se ele estiver cheio, em
+//uma nova extensao. Retorna 0 se bem sucedido ou -1 caso contrario
+int __inodeAddExtentBlock (Inode *i, unsigned int blockAddr,
+                           unsigned int sectorsPerBlock) {
+	unsigned int fill;
+	Inode *tail = __inodeGetTail (i, 1, &fill);
+	int numExtents = (tail != i ? EXTENTS_PEREXT : EXTENTS_PERHEAD);
+	int last = (int) fill - 1, ret;
+	unsigned int niNumber;
+	if (!tail) return -1;
+
+	if (last >= 0 && tail->inodeItem[2*last] + tail->inodeItem[2*last+1]
+	                 * sectorsPerBlock == blockAddr) {
+		tail->inodeItem[2*last+1]++;
+		ret = inodeSave (tail);
+		if (tail != i) inodePut (tail);
+		if (ret == 0) __inodeExtentMapAppend (i, blockAddr, 1);
+		else __inodeDropMap (i);
+		return ret;
+	}
+	if (last + 1 < numExtents) {
+		tail->inodeItem[2*(last+1)] = blockAddr;
+		tail->inodeItem[2*(last+1)+1] = 1;
+		ret = inodeSave (tail);
+		if (tail != i) inodePut (tail);
+		if (ret == 0) {
+			__inodeExtentMapAppend (i, blockAddr, 0);
+			i->tailFill++;
+		}
+		else __inodeDropMap (i);
+		return ret;
+	}
+
+	//Ultimo i-node da cadeia cheio. Obter nova extensao
+	niNumber = inodeFindFreeInode (tail->number, i->d);
+	if (niNumber) {
+		tail->next = niNumber;
+		ret = inodeSave (tail);
+		//Sem o encadeamento gravado, a extensao volta a ficar livre
+		if (ret < 0) {
+			tail->next = 0;
+			inodeRelease (niNumber, i->d);
+		}
+	}
+	else ret = -1;
+	if (tail != i) inodePut (tail);
+	if (ret < 0) {
+		__inodeDropMap (i);
+		return -1;
+	}
+	tail = inodeGet (niNumber, i->d);
+	if (!tail) {
+		__inodeDropMap (i);
+		return -1;
+	}
+	tail->inodeItem[0] = blockAddr;
+	tail->inodeItem[1] = 1;
+	ret = inodeSave (tail);
+	inodePut (tail);
+	if (ret == 0) {
+		__inodeExtentMapAppend (i, blockAddr, 0);
+		i->tailNumber = niNumber;
+		i->tailFill = 1;
+	}
+	else __inodeDropMap (i);
+	return ret;
+}
+
+//Funcao interna que indica se os i-nodes de um disco tem gravacao adiada
+int __inodeWriteBack (Disk *d) {
+	for (int a = 0; a < INODE_MAXDISKS; a++)
+		if (writeBackDisks[a] == d) return 1;
+	return 0;
+}
+
+//Funcao interna que copia os enderecos de blocos, atributos e encadeamento do
+//i-node i para sua posicao no setor da tabela de i-nodes que o contem
+void __inodeEncode (Inode *i, unsigned char *sector) {
+	unsigned long int sizeUInt = sizeof(unsigned int);
+	//Posicao de inicio do i-node dentro do setor
+	unsigned long int offset = ((i->number - 1) %
+		(DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
+		* INODE_SIZE * sizeUInt;
+	unsigned int link[2] = { i->number, i->next };
+
+	ul2chars (i->inodeItem, &sector[offset], NUMITEMS_PERINODE);
+	ul2chars (link, &sector[offset+NUMITEMS_PERINODE*sizeUInt], 2);
+}
+
+//Funcao interna que grava o setor da tabela de i-nodes onde esta' o i-node i,
+//levando junto, na mesma escrita, todas as entradas alteradas da cache que
+//compartilham o setor. O setor so' e' lido do disco se algum de seus i-nodes
+//nao for gravado. Retorna 0 se bem sucedido ou -1 caso contrario
+int __inodeWriteSector (Inode *i) {
+	unsigned int perSector = inodeNumInodesPerSector ();
+	unsigned int first = (i->number - 1) / perSector * perSector + 1;
+	unsigned long int inodeSectorAddr = INODE_BEGINSECTOR
+	                                    + (i->number - 1) / perSector;
+	unsigned char sector[DISK_SECTORDATASIZE];
+	Inode *batch[DISK_SECTORDATASIZE / (INODE_SIZE * sizeof (unsigned int))];
+	unsigned int count = 0;
+	Inode *e;
+
+	for (unsigned int n = first; n < first + perSector; n++) {
+		e = __inodeCacheLookup (n, i->d);
+		if (n == i->number || (e && e->dirty)) batch[count++] = e;
+	}
+	if (count < perSector &&
+	    __inodeReadTableSector (i->d, inodeSectorAddr - INODE_BEGINSECTOR,
+	                            sector) < 0) return -1;
+	//O proprio i e' gravado por ultimo, prevalecendo sobre sua entrada
+	for (unsigned int a = 0; a < count; a++)
+		if (batch[a] && batch[a]->number != i->number)
+			__inodeEncode (batch[a], sector);
+	__inodeEncode (i, sector);
+
+	//Salvando todo o setor onde se encontram os i-nodes...
+	if (__inodeTouchTableSector (i->d, inodeSectorAddr - INODE_BEGINSECTOR)
+	    < 0) return -1;
+	if (diskWriteSector (i->d, inodeSectorAddr, sector) < 0) return -1;
+
+	//Mantendo a cache coerente com a copia salva
+	for (unsigned int a = 0; a < count; a++) {
+		if (!batch[a]) continue;
+		if (batch[a]->number == i->number && batch[a] != i) {
+			__inodeCopy (batch[a], i);
+			__inodeDropMap (batch[a]);
+		}
+		batch[a]->dirty = 0;
+	}
+	return 0;
+}
+
+//Funcao que define o layout de enderecamento dos i-nodes de um disco
+//(INODE_LAYOUT_BLOCKS ou INODE_LAYOUT_EXTENTS), cujos blocos tem
+//sectorsPerBlock setores. Retorna 0 se bem sucedido ou -1 caso contrario
+int inodeSetLayout (Disk *d, int layout, unsigned int sectorsPerBlock) {
+	InodeLayout *l = __inodeExtentLayout (d);
+	if (layout == INODE_LAYOUT_BLOCKS) {
+		if (l) l->d = NULL;
+		return 0;
+	}
+	if (layout != INODE_LAYOUT_EXTENTS || sectorsPerBlock == 0 || !d)
+		return -1;
+	if (!l) l = __inodeExtentLayout (NULL);
+	if (!l) return -1;
+	l->d = d;
+	l->sectorsPerBlock = sectorsPerBlock;
+	return 0;
+}
+
+//Funcao que associa ao disco d um mapa de i-nodes livres para numInodes
+//i-nodes, gravado no setor sector. Com rebuild nulo, o mapa e' lido do
+//setor; caso contrario, e' reconstruido a partir da tabela de i-nodes (um
+//i-node e' ocupado se tiver tipo de arquivo ou primeiro endereco de bloco) e
+//gravado no proximo inodeCacheFlush. Retorna 0 se bem sucedido ou -1 caso
+//contrario
+int inodeAttachFreeMap (Disk *d, unsigned int sector, unsigned int numInodes,
+                        int rebuild) {
+	InodeFreeMap *m = __inodeFreeMapOf (d);
+	unsigned char buf[DISK_SECTORDATASIZE];
+	if (!d || numInodes < 1 || numInodes > INODE_MAPMAXINODES) return -1;
+	if (!m) m = __inodeFreeMapOf (NULL);
+	if (!m) return -1;
+	for (int a = 0; a < INODE_MAPWORDS; a++) m->words[a] = 0;
+	m->sector = sector;
+	m->numInodes = numInodes;
+	m->hint = 0;
+	m->dirty = 0;
+	if (!rebuild) {
+		if (diskReadSector (d, sector, buf) < 0) return -1;
+		for (int a = 0; a < DISK_SECTORDATASIZE; a++)
+			m->words[a / 8] |= (unsigned long long) buf[a]
+			                   << (a % 8 * 8);
+	}
+	else {
+		//Le a tabela de i-nodes de uma vez so'
+		unsigned long int sizeUInt = sizeof(unsigned int);
+		unsigned long int perSector = DISK_SECTORDATASIZE
+		                              / (INODE_SIZE * sizeUInt);
+		unsigned long int numSectors = (numInodes + perSector - 1)
+		                               / perSector;
+		InodeLazyTable *t = __inodeLazyTableOf (d);
+		unsigned char *table = calloc (numSectors, DISK_SECTORDATASIZE);
+		if (!table) return -1;
+		//Setores ainda nao inicializados so' tem i-nodes livres
+		if (t && t->initSectors < numSectors) numSectors = t->initSectors;
+		if (numSectors > 0 &&
+		    diskReadSectors (d, INODE_BEGINSECTOR, numSectors, table) < 0) {
+			free (table);
+			return -1;
+		}
+		for (unsigned int n = 1; n <= numInodes; n++) {
+			unsigned int item[INODE_SIZE];
+			char2uls (table + (n - 1) * INODE_SIZE * sizeUInt, item,
+			          INODE_SIZE);
+			//Ocupado: arquivo com tipo definido ou extensao com blocos
+			if (n == 1 || item[INODE_ITEM_BLOCKADDR] != 0 ||
+			    item[INODE_ITEM_FILETYPE] != 0)
+				m->words[(n - 1) / 64] |= 1ULL << ((n - 1) % 64);
+		}
+		free (table);
+		m->dirty = 1;
+	}
+	//Bits alem de numInodes ficam sempre ocupados
+	for (unsigned int n = numInodes; n < INODE_MAPMAXINODES; n++)
+		m->words[n / 64] |= 1ULL << (n % 64);
+	m->d = d;
+	return 0;
+}
+
+//Funcao que grava, se alterado, e dissocia o mapa de i-nodes livres do disco
+//d. Retorna 0 se bem sucedido ou -1 caso contrario
+int inodeDetachFreeMap (Disk *d) {
+	InodeFreeMap *m = __inodeFreeMapOf (d);
+	int ret;
+	if (!m || !d) return 0;
+	ret = __inodeFreeMapSave (m);
+	m->d = NULL;
+	return ret;
+}
+
+//Funcao que associa ao disco d uma tabela de i-nodes de numSectors setores,
+//dos quais apenas os primeiros initSectors estao inicializados no disco e
+//cuja marca e' persistida por save, se nao for NULL. Retorna 0 se bem
+//sucedido ou -1 caso contrario
+int inodeAttachLazyTable (Disk *d, unsigned int initSectors,
+                          unsigned int numSectors, InodeTableInitSaver save) {
+	InodeLazyTable *t = __inodeLazyTableOf (d);
+	if (!d || initSectors > numSectors) return -1;
+	if (!t) t = __inodeLazyTableOf (NULL);
+	if (!t) return -1;
+	t->initSectors = initSectors;
+	t->numSectors = numSectors;
+	t->save = save;
+	t->d = d;
+	return 0;
+}
+
+//Funcao que retorna o numero de setores inicializados da tabela de i-nodes
+//do disco d, ou 0 se nenhuma tabela sob demanda estiver associada a ele
+unsigned int inodeGetLazyTableInit (Disk *d) {
+	InodeLazyTable *t = __inodeLazyTableOf (d);
+	return (t && d ? t->initSectors : 0);
+}
+
+//Funcao que dissocia a tabela de i-nodes sob demanda do disco d
+void inodeDetachLazyTable (Disk *d) {
+	InodeLazyTable *t = __inodeLazyTableOf (d);
+	if (t && d) t->d = NULL;
+}
+
+//Funcao que liga (on nao nulo) ou desliga a gravacao adiada dos i-nodes do
+//disco d. Ao desligar, os i-nodes alterados sao salvos. Retorna 0 se bem
+//sucedido ou -1 caso contrario
+int inodeSetWriteBack (Disk *d, int on) {
+	int slot = -1;
+	if (!d) return -1;
+	for (int a = 0; a < INODE_MAXDISKS; a++) {
+		if (writeBackDisks[a] == d) {
+			if (on) return 0;
+			writeBackDisks[a] = NULL;
+			return inodeCacheFlush (d);
+		}
+		if (!writeBackDisks[a] && slot < 0) slot = a;
+	}
+	if (!on) return 0;
+	if (slot < 0) return -1;
+	writeBackDisks[slot] = d;
+	return 0;
+}
+
+//Funcao que retorna o layout de enderecamento dos i-nodes de um disco
+int inodeGetLayout (Disk *d) {
+	return (__inodeExtentLayout (d) ? INODE_LAYOUT_EXTENTS
+	                                : INODE_LAYOUT_BLOCKS);
 }
 
 //Funcao que retorna o numero de i-nodes por setor
@@ -74,13 +831,16 @@ unsigned int inodeNumBlockAddresses ( void ) {
 //que deve ser unico no sistema de arquivos. Retorna ponteiro para o i-node
 //criado ou NULL se nao houver memoria suficiente ou number invalido. A funcao
 //salva o i-node em disco, com conteudo vazio e, portanto, o sobrescreve se ja 
-//existente
+//existente. O i-node retornado e' uma copia propria, fora da cache
 Inode* inodeCreate (unsigned int number, Disk *d) {
 	if (number < 1) return NULL;
 	Inode *i = malloc (sizeof(Inode));
+	if (!i) return NULL;
+	__inodeInitUncached (i);
 	i->d = d;
 	i->number = number;
 	i->next = 0;
+	__inodeMarkUsed (d, number, 1);
 	if ( inodeClear (i) == 0 ) return i;
 	else free (i);
 	return NULL;
@@ -91,17 +851,20 @@ Inode* inodeCreate (unsigned int number, Disk *d) {
 int inodeClear (Inode *i) {
 	if (i) {
 		if (i->next != 0) {
-			Inode* ni = inodeLoad (i->next, i->d);
+			Inode* ni = inodeGet (i->next, i->d);
 			if ( !ni ) return -1;
 			if ( inodeClear (ni) != 0 ) {
-				free (ni);
+				inodePut (ni);
 				return -1;
 			}
-			free (ni);
+			//A extensao deixa a cadeia e volta a ficar livre
+			__inodeMarkUsed (i->d, ni->number, 0);
+			inodePut (ni);
 		}	
 		i->next = 0;
 		for (int a = 0; a < NUMITEMS_PERINODE; a++)
 			i->inodeItem[a] = 0;
+		__inodeDropMap (i);
 		return inodeSave(i);
 	}
 	return -1;
@@ -111,149 +874,267 @@ int inodeClear (Inode *i) {
 //ou -1 caso contrario. I-nodes sao salvos a partir do setor INODE_1STSECTOR. Numero de
 //i-nodes por setor pode variar de acordo com o tamanho do tipo unsigned int
 //Em arquiteturas de 64 bits testadas, unsigned int ocupa 32 bits. Nesse caso,
-//cada setor pode receber 8 i-nodes 
+//cada setor pode receber 8 i-nodes. Em discos com gravacao adiada
+//(inodeSetWriteBack), o i-node apenas fica marcado como alterado na cache
 int inodeSave (Inode *i) {
 	if (i) {
-		unsigned long int sizeUInt = sizeof(unsigned int);
-		//Endereco do setor no qual o i-node sera' salvo
-		unsigned long int inodeSectorAddr = 
-			INODE_BEGINSECTOR + (i->number - 1) * INODE_SIZE 
-			* sizeUInt / DISK_SECTORDATASIZE;
-		unsigned char sector[DISK_SECTORDATASIZE];
-
-		int ret = diskReadSector (i->d, inodeSectorAddr, sector);
-		if (ret < 0) return ret;
-
-		//Posicao de inicio do i-node dentro do setor
-		unsigned long int offset = ((i->number - 1) % 
-			   (DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
-                           * INODE_SIZE * sizeUInt;
-
-		//Alterando enderecos de blocos e atributos do i-node no setor
-		for (int a=0; a < NUMITEMS_PERINODE; a++)
-			ul2char (i->inodeItem[a], 
-			         &sector[offset+a*sizeUInt]);
-		ul2char (i->number, 
-		         &sector[offset+(INODE_SIZE-2)*sizeUInt]);
-		ul2char (i->next, 
-			 &sector[offset+(INODE_SIZE-1)*sizeUInt]);
-
-		//Salvando todo o setor onde se encontra o i-node...
-		ret = diskWriteSector (i->d, inodeSectorAddr, sector);
-		return ret;
+		Inode *e;
+		if (!__inodeWriteBack (i->d)) return __inodeWriteSector (i);
+		if (i->cached) {
+			i->dirty = 1;
+			return 0;
+		}
+		//Copia fora da cache: a alteracao passa para a entrada da cache,
+		//que e' obtida (lendo o setor) se ainda nao estiver presente
+		e = __inodeCacheLookup (i->number, i->d);
+		if (e) {
+			if (e->refs++ == 0) __inodeLruUnlink (e);
+		}
+		else e = inodeGet (i->number, i->d);
+		if (!e) return __inodeWriteSector (i);
+		__inodeCopy (e, i);
+		__inodeDropMap (e);
+		e->dirty = 1;
+		inodePut (e);
+		return 0;
 	}
 	return -1;
 }
 
-//Funcao que recupera um i-node a partir do disco. Retorna ponteiro para o
-//i-node lido ou NULL em caso de falha.
+//Funcao que recupera um i-node, passando pela cache. Retorna ponteiro para
+//uma copia propria do i-node, a ser liberada pelo chamador, ou NULL em caso
+//de falha.
 Inode* inodeLoad (unsigned int number, Disk *d) {
-	unsigned long int sizeUInt = sizeof(unsigned int);
-	//Endereco do setor do qual o i-node sera' lido
-	unsigned long int inodeSectorAddr = 
-		INODE_BEGINSECTOR + (number - 1) * INODE_SIZE * sizeUInt
-		    / DISK_SECTORDATASIZE;
-	unsigned char sector[DISK_SECTORDATASIZE];
+	Inode *e = inodeGet (number, d);
 	Inode *i = NULL;
-
-	int ret = diskReadSector (d, inodeSectorAddr, sector);
-	if (ret < 0) return NULL;
-
-	//Posicao de inicio do i-node dentro do setor
-	unsigned long int offset = ((number - 1) % 
-		(DISK_SECTORDATASIZE / (INODE_SIZE * sizeUInt)))
-		* INODE_SIZE * sizeUInt;
-
+	if (!e) return NULL;
 	i = malloc (sizeof(Inode));
 	if (i) {
-		i->d = d;
-		//Recuperando enderecos de blocos e atributos do i-node no setor
-		for (int a=0; a < NUMITEMS_PERINODE; a++)
-			char2ul (&sector[offset+a*sizeUInt],
-			         &(i->inodeItem[a]));
-		char2ul (&sector[offset+(INODE_SIZE-2)*sizeUInt],
-		         &(i->number));
-		char2ul (&sector[offset+(INODE_SIZE-1)*sizeUInt],
-		         &(i->next));
+		__inodeInitUncached (i);
+		__inodeCopy (i, e);
 	}
+	inodePut (e);
 	return i;
 }
 
+//Funcao que obtem uma referencia para o i-node number de um disco a partir
+//da cache de i-nodes, lendo-o do disco apenas se nao estiver presente
+Inode* inodeGet (unsigned int number, Disk *d) {
+	Inode tmp, *e;
+	if (number < 1) return NULL;
+	e = __inodeCacheLookup (number, d);
+	if (e) {
+		if (e->refs++ == 0) __inodeLruUnlink (e);
+		return e;
+	}
+
+	if (__inodeRead (number, d, &tmp) < 0) return NULL;
+
+	//Reaproveitando a entrada sem referencias menos recente, se a cache
+	//estiver cheia e ela puder ser salva
+	e = NULL;
+	if (cacheCount >= INODE_CACHESIZE && lruTail &&
+	    (!lruTail->dirty || __inodeWriteSector (lruTail) == 0)) {
+		e = lruTail;
+		__inodeLruUnlink (e);
+		__inodeCacheRemove (e);
+		__inodeDropMap (e);
+	}
+	if (!e) e = malloc (sizeof(Inode));
+	if (!e) return NULL;
+
+	__inodeInitUncached (e);
+	__inodeCopy (e, &tmp);
+	e->cached = 1;
+	e->refs = 1;
+	e->hashNext = cacheBuckets[__inodeHash (number, d)];
+	cacheBuckets[__inodeHash (number, d)] = e;
+	cacheCount++;
+	return e;
+}
+
+//Funcao que devolve um i-node obtido por inodeGet. Tambem libera copias
+//obtidas por inodeLoad ou inodeCreate
+void inodePut (Inode *i) {
+	if (!i) return;
+	if (!i->cached) {
+		if (i->refs == 0 || --i->refs == 0) __inodeFree (i);
+		return;
+	}
+	if (--i->refs > 0) return;
+
+	//Entrada sem referencias: volta para a lista LRU, ou sai da cache se
+	//ela estiver acima da capacidade
+	if (cacheCount > INODE_CACHESIZE &&
+	    (!i->dirty || __inodeWriteSector (i) == 0)) {
+		__inodeCacheRemove (i);
+		__inodeFree (i);
+	}
+	else __inodeLruPushFront (i);
+}
+
+//Funcao que salva todos os i-nodes alterados na cache que pertencem ao disco
+//d, agrupados por setor: cada setor da tabela de i-nodes e' escrito uma unica
+//vez, com todos os seus i-nodes alterados. Retorna 0 se bem sucedido ou -1
+//caso contrario
+int inodeCacheFlush (Disk *d) {
+	InodeFreeMap *m = __inodeFreeMapOf (d);
+	int ret = 0;
+	if (m && d && __inodeFreeMapSave (m) < 0) ret = -1;
+	//A gravacao de um setor limpa as demais entradas alteradas nele
+	for (int b = 0; b < INODE_CACHEBUCKETS; b++)
+		for (Inode *e = cacheBuckets[b]; e; e = e->hashNext)
+			if (e->d == d && e->dirty && __inodeWriteSector (e) < 0)
+				ret = -1;
+	return ret;
+}
+
+//Funcao que descarta da cache todos os i-nodes do disco d, sem salva-los.
+//Entradas ainda referenciadas deixam a cache e sao liberadas no inodePut
+void inodeCacheInvalidate (Disk *d) {
+	for (int b = 0; b < INODE_CACHEBUCKETS; b++) {
+		Inode *e = cacheBuckets[b], *n;
+		for (; e; e = n) {
+			n = e->hashNext;
+			if (e->d != d) continue;
+			__inodeCacheRemove (e);
+			if (e->refs == 0) {
+				__inodeLruUnlink (e);
+				__inodeFree (e);
+			}
+		}
+	}
+}
+
 //Funcao que modifica o tipo de arquivo referente a um i-node
 void inodeSetFileType (Inode *i, unsigned int fileType) {
-	if (i) i->inodeItem[INODE_ITEM_FILETYPE] = fileType;
+	if (i) {
+		i->inodeItem[INODE_ITEM_FILETYPE] =
+			(i->inodeItem[INODE_ITEM_FILETYPE] & INODE_INLINE) | fileType;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica o tamanho do arquivo referente a um i-node, em bytes
 void inodeSetFileSize (Inode *i, unsigned int fileSize) {
-	if (i) i->inodeItem[INODE_ITEM_FILESIZE] = fileSize;
+	if (i) {
+		i->inodeItem[INODE_ITEM_FILESIZE] = fileSize;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica o proprietario do arquivo referente a um i-node
 void inodeSetOwner (Inode *i, unsigned int owner) {
-	if (i) i->inodeItem[INODE_ITEM_OWNER] = owner;
+	if (i) {
+		i->inodeItem[INODE_ITEM_OWNER] = owner;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica o grupo proprietario do arquivo referente a um i-node
 void inodeSetGroupOwner (Inode *i, unsigned int groupOwner) {
-	if (i) i->inodeItem[INODE_ITEM_GROUPOWNER] = groupOwner;
+	if (i) {
+		i->inodeItem[INODE_ITEM_GROUPOWNER] = groupOwner;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica as permissoes de acesso ao arquivo referente a um i-node
 void inodeSetPermission (Inode *i, unsigned int permission) {
-	if (i) i->inodeItem[INODE_ITEM_PERMISSION] = permission;
+	if (i) {
+		i->inodeItem[INODE_ITEM_PERMISSION] = permission;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que modifica o contador de referencia do arquivo referente a um i-node
 void inodeSetRefCount (Inode *i, unsigned int refCount) {
-	if (i) i->inodeItem[INODE_ITEM_REFCOUNT] = refCount;
+	if (i) {
+		i->inodeItem[INODE_ITEM_REFCOUNT] = refCount;
+		i->dirty = 1;
+	}
 }
 
 //Funcao que adiciona um endereco ao fim do array de blocos de um i-node
 //Retorna -1 caso a inclusao do endereco nao seja bem sucedida
-//E' a unica funcao que salva automaticamente o i-node em disco
+//E' a unica funcao que salva automaticamente o i-node em disco: apenas o
+//ultimo i-node da cadeia, memorizado na entrada da cache do i-node, e' salvo
+//(e a extensao anterior, quando uma nova e' criada)
 int inodeAddBlock (Inode *i, unsigned int blockAddr) {
-	if (i) {
+	if (i && !i->cached && !inodeIsInline (i)) {
+		//Copia fora da cache: o acrescimo e' feito na entrada da cache,
+		//unica a memorizar o fim da cadeia, e os enderecos e o
+		//encadeamento resultantes voltam para a copia
+		Inode *e = inodeGet (i->number, i->d);
+		int ret;
+		if (!e) return -1;
+		ret = inodeAddBlock (e, blockAddr);
+		for (int a = 0; a < NUMBLOCKS_PERINODE; a++)
+			i->inodeItem[a] = e->inodeItem[a];
+		i->next = e->next;
+		inodePut (e);
+		return ret;
+	}
+	if (i && !inodeIsInline (i)) {
 		Disk *d = i->d;
+		InodeLayout *l = __inodeExtentLayout (d);
+		if (l) return __inodeAddExtentBlock (i, blockAddr,
+		                                     l->sectorsPerBlock);
 		Inode* lastInodeExt = NULL;
-		unsigned int niNumber;
-		int ret, numblocks = NUMBLOCKS_PERINODE;
-		lastInodeExt = __inodeGetLastExtension (i);
-		if (lastInodeExt) {
-			numblocks = NUMITEMS_PERINODE;
-			if ( inodeSave (i) < 0 ) return -1;
-		}
-		else if (i->next != 0) return -1;
-		else lastInodeExt = i;
-
-		for (int a = 0; a < numblocks; a++)
-			//Encontrar bloco sem endereco
-			if (lastInodeExt->inodeItem[a] == 0) {
-				lastInodeExt->inodeItem[a] = blockAddr;
-				ret = inodeSave(lastInodeExt);
-				if (numblocks != NUMBLOCKS_PERINODE) 
-					free (lastInodeExt);
-				return ret;
+		unsigned int niNumber, fill;
+		int ret, numblocks;
+		//Apenas o ultimo i-node da cadeia e' alterado e salvo
+		lastInodeExt = __inodeGetTail (i, 0, &fill);
+		if (!lastInodeExt) return -1;
+		numblocks = (lastInodeExt != i ? NUMITEMS_PERINODE
+		                               : NUMBLOCKS_PERINODE);
+
+		if (fill < (unsigned int) numblocks) {
+			lastInodeExt->inodeItem[fill] = blockAddr;
+			ret = inodeSave(lastInodeExt);
+			if (lastInodeExt != i) inodePut (lastInodeExt);
+			//O ultimo i-node da cadeia ocupa as ultimas
+			//numblocks posicoes do mapa
+			if (ret == 0) {
+				__inodeMapSet (i, i->mapLen - numblocks + fill,
+				               blockAddr);
+				i->tailFill++;
 			}
+			else __inodeDropMap (i);
+			return ret;
+		}
 		//i-node esta' sem bloco a preencher. Obter nova extensao
 		niNumber = inodeFindFreeInode (lastInodeExt->number, d);
 		if (niNumber) {
 			lastInodeExt->next = niNumber;
 			ret = inodeSave (lastInodeExt);
-			if (numblocks != NUMBLOCKS_PERINODE) 
-				free (lastInodeExt);
-			if (ret < 0) return ret;
+			//Sem o encadeamento gravado, a extensao volta a
+			//ficar livre
+			if (ret < 0) {
+				lastInodeExt->next = 0;
+				inodeRelease (niNumber, d);
+			}
 		}
-		else {
-			if (numblocks != NUMBLOCKS_PERINODE)
-				free (lastInodeExt);
+		else ret = -1;
+		if (lastInodeExt != i) inodePut (lastInodeExt);
+		if (ret < 0) {
+			__inodeDropMap (i);
+			return -1;
+		}
+		lastInodeExt = inodeGet (niNumber, d);
+		if (!lastInodeExt) {
+			__inodeDropMap (i);
 			return -1;
 		}
-		lastInodeExt = inodeLoad (niNumber, d);
-		if (!lastInodeExt) return -1;
 		lastInodeExt->inodeItem[0] = blockAddr;
 		ret = inodeSave (lastInodeExt);
-		free (lastInodeExt);
+		inodePut (lastInodeExt);
+		if (ret == 0) {
+			__inodeMapSet (i, i->mapLen, blockAddr);
+			i->tailNumber = niNumber;
+			i->tailFill = 1;
+		}
+		else __inodeDropMap (i);
 		return ret;
 	}
 	return -1;
@@ -272,7 +1153,7 @@ unsigned int inodeGetNextNumber (Inode *i) {
 
 //Funcao que retorna o tipo de arquivo referente a um i-node.
 unsigned int inodeGetFileType (Inode *i) {
-	return (i ? i->inodeItem[INODE_ITEM_FILETYPE] : 0);
+	return (i ? i->inodeItem[INODE_ITEM_FILETYPE] & ~INODE_INLINE : 0);
 }
 
 //Funcao que retorna o tamanho do arquivo referente ao i-node, em bytes
@@ -306,43 +1187,150 @@ unsigned int inodeGetRefCount (Inode *i) {
 
 //Funcao que retorna o endereco correspondente a um bloco (blockNum) no array
 //de blocos de um i-node. O i-node precisa ser o primeiro de sua cadeia.
-//Retorna 0 se o bloco nao possuir endereco em blockNum
+//Para i-nodes da cache, a consulta usa o mapa de blocos, montado na primeira
+//consulta alem do proprio i-node e mantido por inodeAddBlock, sem percorrer
+//a cadeia de extensoes; no layout de extents, por busca binaria no mapa de
+//extents. Retorna 0 se o bloco nao possuir endereco em blockNum, o que vale
+//para todos os blocos de i-nodes com dados embutidos
 unsigned int inodeGetBlockAddr (Inode *i, unsigned int blockNum) {
-	unsigned int numblocks = NUMBLOCKS_PERINODE;
-	if (i) {
+	if (i && !inodeIsInline (i)) {
+		InodeLayout *l = __inodeExtentLayout (i->d);
+		if (l) return __inodeExtentLookup (i, blockNum,
+		                                   l->sectorsPerBlock);
 		if (blockNum < NUMBLOCKS_PERINODE)
 			return i->inodeItem[blockNum];
+		else if (i->cached) {
+			if (!i->blockMap && __inodeBuildMap (i) < 0) return 0;
+			return (blockNum < i->mapLen ? i->blockMap[blockNum] : 0);
+		}
 		else {
 			unsigned int extNum = 1 + 
 			                      (blockNum - NUMBLOCKS_PERINODE) 
 			                      / NUMITEMS_PERINODE;
 			unsigned int offset = (blockNum - NUMBLOCKS_PERINODE)
 			                      % NUMITEMS_PERINODE;
-			Inode *ni = inodeLoad (i->next, i->d);
-			for (int a = 1; a < extNum; a++) {
-				Disk *d = ni->d;
-				unsigned int niNumber = ni->next;
-				free (ni);
-				ni = inodeLoad (niNumber, d);
+			unsigned int niNumber = i->next, addr;
+			Inode *ni = NULL;
+			for (unsigned int a = 1; a <= extNum; a++) {
+				inodePut (ni);
+				ni = (niNumber ? inodeGet (niNumber, i->d) : NULL);
+				if (!ni) return 0;
+				niNumber = ni->next;
 			}
-			return ni->inodeItem[offset];
+			addr = ni->inodeItem[offset];
+			inodePut (ni);
+			return addr;
 		}
 	}
 	return 0;
 }
 
 //Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
-//startFrom. Retorna o numero do inode livre encontrado ou 0 se nao encontrado.
+//startFrom. Com mapa de i-nodes livres associado ao disco, a busca e' feita
+//no mapa em memoria e o i-node encontrado passa a constar como ocupado.
+//Retorna o numero do inode livre encontrado ou 0 se nao encontrado.
 unsigned int inodeFindFreeInode (unsigned int startFrom, Disk *d) {
-	Inode *i = NULL;
+	InodeFreeMap *m = __inodeFreeMapOf (d);
+	Inode tmp, *i = NULL;
 	unsigned int number = 0;
 	if (startFrom < 1) return 0;
+	if (m && d) {
+		//Busca next-fit, uma palavra de 64 i-nodes por vez, a partir da
+		//palavra onde a ultima busca terminou
+		unsigned int first = (startFrom - 1) / 64;
+		unsigned int w = (m->hint > first ? m->hint : first);
+		for (unsigned int k = 0; k < INODE_MAPWORDS; k++) {
+			unsigned long long word = m->words[w];
+			//Na palavra de startFrom, ignora os i-nodes anteriores
+			if (w == first)
+				word |= (1ULL << ((startFrom - 1) % 64)) - 1;
+			if (~word) {
+				number = w * 64 + __inodeFirstZeroBit (word) + 1;
+				m->hint = w;
+				__inodeMarkUsed (d, number, 1);
+				return number;
+			}
+			w = (w + 1 < INODE_MAPWORDS ? w + 1 : first);
+		}
+		return 0;
+	}
+	//A varredura consulta a cache, mas nao a preenche, para nao despejar
+	//os i-nodes em uso
 	for (unsigned int a = startFrom; number == 0; a++) {
-		i = inodeLoad (a, d);
-		if (!i) break;
-		if (inodeGetBlockAddr(i, 0) == 0)
+		i = __inodeCacheLookup (a, d);
+		if (!i) {
+			if (__inodeRead (a, d, &tmp) < 0) break;
+			i = &tmp;
+		}
+		if (i->inodeItem[0] == 0 && !inodeIsInline (i))
 			number = inodeGetNumber(i);
-		free (i);
 	}
 	return number;
 }
+
+//Funcao que devolve ao mapa de i-nodes livres do disco d o i-node number,
+//obtido por inodeFindFreeInode mas nao ligado ao sistema de arquivos
+void inodeRelease (unsigned int number, Disk *d) {
+	__inodeMarkUsed (d, number, 0);
+}
+
+//Funcao que retorna o numero de bytes de dados que cabem no proprio i-node
+unsigned int inodeInlineCapacity ( void ) {
+	return NUMBLOCKS_PERINODE * sizeof (unsigned int);
+}
+
+//Funcao que indica se os dados do arquivo referente a um i-node estao
+//embutidos no proprio i-node
+int inodeIsInline (Inode *i) {
+	return (i && (i->inodeItem[INODE_ITEM_FILETYPE] & INODE_INLINE) ? 1 : 0);
+}
+
+//Funcao que copia para buf nbytes dos dados embutidos em um i-node, a partir
+//do byte offset. Os dados ocupam as posicoes de enderecos de blocos na mesma
+//ordem de bytes em que sao gravados no disco. Retorna o numero de bytes
+//copiados ou -1 se o i-node nao tiver dados embutidos
+int inodeReadInline (Inode *i, unsigned int offset, unsigned char *buf,
+                     unsigned int nbytes) {
+	unsigned char data[NUMBLOCKS_PERINODE * sizeof (unsigned int)];
+	if (!inodeIsInline (i)) return -1;
+	if (offset >= sizeof (data)) return 0;
+	if (nbytes > sizeof (data) - offset) nbytes = sizeof (data) - offset;
+	ul2chars (&i->inodeItem[INODE_ITEM_BLOCKADDR], data, NUMBLOCKS_PERINODE);
+	memcpy (buf, data + offset, nbytes);
+	return nbytes;
+}
+
+//Funcao que grava nbytes de buf nos dados embutidos em um i-node, a partir do
+//byte offset. Um i-node sem blocos passa a ter dados embutidos. Retorna 0 se
+//bem sucedido ou -1 se o i-node tiver blocos ou os dados nao couberem nele
+int inodeWriteInline (Inode *i, unsigned int offset, const unsigned char *buf,
+                      unsigned int nbytes) {
+	unsigned char data[NUMBLOCKS_PERINODE * sizeof (unsigned int)];
+	if (!i || offset > sizeof (data) || nbytes > sizeof (data) - offset)
+		return -1;
+	if (!inodeIsInline (i)) {
+		if (i->next != 0) return -1;
+		for (int a = 0; a < NUMBLOCKS_PERINODE; a++)
+			if (i->inodeItem[INODE_ITEM_BLOCKADDR + a] != 0) return -1;
+		__inodeDropMap (i);
+		i->inodeItem[INODE_ITEM_FILETYPE] |= INODE_INLINE;
+	}
+	ul2chars (&i->inodeItem[INODE_ITEM_BLOCKADDR], data, NUMBLOCKS_PERINODE);
+	memcpy (data + offset, buf, nbytes);
+	char2uls (data, &i->inodeItem[INODE_ITEM_BLOCKADDR], NUMBLOCKS_PERINODE);
+	i->dirty = 1;
+	return 0;
+}
+
+//Funcao que descarta os dados embutidos em um i-node, liberando suas posicoes
+//de enderecos para inodeAddBlock. O i-node nao e' salvo. Retorna 0 se bem
+//sucedido ou -1 se o i-node nao tiver dados embutidos
+int inodeDropInline (Inode *i) {
+	if (!inodeIsInline (i)) return -1;
+	for (int a = 0; a < NUMBLOCKS_PERINODE; a++)
+		i->inodeItem[INODE_ITEM_BLOCKADDR + a] = 0;
+	i->inodeItem[INODE_ITEM_FILETYPE] &= ~INODE_INLINE;
+	__inodeDropMap (i);
+	i->dirty = 1;
+	return 0;
+}
@@ -18,6 +18,13 @@
 //Tipo para representacao de i-nodes
 typedef struct inode Inode;
 
+//Layouts de enderecamento de blocos nos i-nodes de um disco
+#define INODE_LAYOUT_BLOCKS 0	//Enderecos de blocos: 8 no i-node principal
+				//e 14 por extensao encadeada
+#define INODE_LAYOUT_EXTENTS 1	//Extents (endereco inicial, numero de
+				//blocos contiguos): 4 no i-node principal e
+				//7 por extensao encadeada
+
 //Funcao que retorna o numero de i-nodes por setor
 unsigned int inodeNumInodesPerSector ( void );
 
@@ -27,11 +34,63 @@ unsigned int inodeAreaBeginSector ( void );
 //Funcao que retorna o numero de enderecos de blocos que cabem em um i-node
 unsigned int inodeNumBlockAddresses ( void );
 
+//Funcao que define o layout de enderecamento dos i-nodes de um disco
+//(INODE_LAYOUT_BLOCKS, o padrao, ou INODE_LAYOUT_EXTENTS), cujos blocos tem
+//sectorsPerBlock setores. Deve ser chamada pelo sistema de arquivos ao
+//montar o disco, antes de qualquer acesso aos enderecos de blocos, e
+//com INODE_LAYOUT_BLOCKS ao desmonta-lo. No layout de extents, blocos
+//contiguos acrescentados por inodeAddBlock formam um unico extent. Retorna 0
+//se bem sucedido ou -1 caso contrario
+int inodeSetLayout (Disk *d, int layout, unsigned int sectorsPerBlock);
+
+//Funcao que retorna o layout de enderecamento dos i-nodes de um disco
+int inodeGetLayout (Disk *d);
+
+//Funcao que associa ao disco d um mapa de i-nodes livres para numInodes
+//i-nodes (no maximo 8 por byte de um setor), persistido no setor sector e
+//mantido em memoria enquanto associado. Com rebuild nulo, o mapa e' lido do
+//setor; caso contrario, e' reconstruido a partir da tabela de i-nodes e
+//gravado no proximo inodeCacheFlush. A partir dai, inodeFindFreeInode
+//consulta apenas o mapa, inodeCreate marca o i-node como ocupado e
+//inodeClear libera as extensoes descartadas. Retorna 0 se bem sucedido ou
+//-1 caso contrario
+int inodeAttachFreeMap (Disk *d, unsigned int sector, unsigned int numInodes,
+                        int rebuild);
+
+//Funcao que grava, se alterado, e dissocia o mapa de i-nodes livres do disco
+//d. Retorna 0 se bem sucedido ou -1 caso contrario
+int inodeDetachFreeMap (Disk *d);
+
+//Tipo de funcao chamada para persistir a marca d'agua initSectors da tabela
+//de i-nodes sob demanda do disco d. Retorna 0 se bem sucedida ou -1 caso
+//contrario
+typedef int (*InodeTableInitSaver) (Disk *d, unsigned int initSectors);
+
+//Funcao que associa ao disco d uma tabela de i-nodes de numSectors setores,
+//dos quais apenas os primeiros initSectors (a marca d'agua) foram gravados
+//no disco. Setores alem da marca sao lidos como se tivessem apenas i-nodes
+//vazios, sem acesso ao disco, e sao inicializados na primeira gravacao de
+//um i-node deles, junto com os que faltarem antes deles, em uma unica
+//escrita. Se save nao for NULL, a nova marca e' persistida por save antes
+//da gravacao do setor que a avancou, de modo que uma queda nunca deixa no
+//disco i-nodes alem da marca. Retorna 0 se bem sucedido ou -1 caso
+//contrario
+int inodeAttachLazyTable (Disk *d, unsigned int initSectors,
+                          unsigned int numSectors, InodeTableInitSaver save);
+
+//Funcao que retorna a marca d'agua da tabela de i-nodes sob demanda do disco
+//d, em setores inicializados, ou 0 se nenhuma estiver associada ao disco
+unsigned int inodeGetLazyTableInit (Disk *d);
+
+//Funcao que dissocia a tabela de i-nodes sob demanda do disco d. Deve ser
+//chamada depois que os i-nodes alterados forem salvos
+void inodeDetachLazyTable (Disk *d);
+
 //Funcao que cria um i-node vazio, identificado pelo seu numero (number),
 //que deve ser unico no sistema de arquivos. Retorna ponteiro para o i-node
 //criado ou NULL se nao houver memoria suficiente ou number invalido. A funcao
 //salva o i-node em disco, com conteudo vazio e, portanto, o sobrescreve se ja 
-//existente
+//existente. O i-node retornado e' uma copia propria, fora da cache
 Inode* inodeCreate (unsigned int number, Disk *d);
 
 //Funcao que limpa todo o conteudo de um i-node. O i-node e' salvo em disco,
@@ -41,13 +100,48 @@ int inodeClear (Inode *i);
 
 //Funcao que persiste um i-node em seu disco. Retorna 0 se gravacao bem sucedida
 //ou -1 caso contrario. I-nodes sao salvos a partir do setor 2. Numero de
-//i-nodes por setor pode variar de acordo com o tamanho do tipo unsigned int
+//i-nodes por setor pode variar de acordo com o tamanho do tipo unsigned int.
+//Em discos com gravacao adiada, o i-node fica alterado na cache e so' vai
+//para o disco em inodeCacheFlush ou no despejo da entrada
 int inodeSave (Inode *i);
 
-//Funcao que recupera um i-node a partir do disco. Retorna ponteiro para o
-//i-node lido ou NULL em caso de falha.
+//Funcao que recupera um i-node, passando pela cache de i-nodes. Retorna
+//ponteiro para uma copia propria do i-node, a ser liberada pelo chamador
+//(free ou inodePut), ou NULL em caso de falha.
 Inode* inodeLoad (unsigned int number, Disk *d);
 
+//Funcao que obtem uma referencia para o i-node number de um disco a partir
+//da cache de i-nodes, indexada por (disco, numero), lendo-o do disco apenas
+//se nao estiver presente. Todas as referencias a um mesmo i-node apontam
+//para a mesma entrada, de modo que alteracoes feitas por uma sao vistas pelas
+//demais. A referencia deve ser devolvida com inodePut. Retorna NULL em caso
+//de falha
+Inode* inodeGet (unsigned int number, Disk *d);
+
+//Funcao que devolve uma referencia obtida por inodeGet. Sem referencias, a
+//entrada permanece na cache ate ser despejada (a menos recentemente usada
+//primeiro); se alterada e nao salva, e' salva antes do despejo. Tambem
+//libera copias obtidas por inodeLoad ou inodeCreate
+void inodePut (Inode *i);
+
+//Funcao que salva todos os i-nodes alterados na cache que pertencem ao disco
+//d, assim como seu mapa de i-nodes livres, se alterado. Os i-nodes sao
+//agrupados por setor, e cada setor da tabela e' escrito uma unica vez.
+//Retorna 0 se bem sucedido ou -1 caso contrario
+int inodeCacheFlush (Disk *d);
+
+//Funcao que liga (on nao nulo) ou desliga a gravacao adiada dos i-nodes do
+//disco d. Com ela ligada, inodeSave e inodeAddBlock apenas alteram a cache,
+//e i-nodes de um mesmo setor sao gravados juntos por inodeCacheFlush ou
+//quando uma entrada alterada e' despejada. Ao desligar, os i-nodes alterados
+//sao salvos. Retorna 0 se bem sucedido ou -1 caso contrario
+int inodeSetWriteBack (Disk *d, int on);
+
+//Funcao que descarta da cache todos os i-nodes do disco d, sem salva-los.
+//Deve ser chamada quando a area de i-nodes e' alterada diretamente no disco
+//(formatacao) ou antes de o disco deixar de ser usado
+void inodeCacheInvalidate (Disk *d);
+
 //Funcao que modifica o tipo de arquivo referente a um i-node
 void inodeSetFileType (Inode *i, unsigned int fileType);
 
@@ -68,7 +162,11 @@ void inodeSetRefCount (Inode *i, unsigned int refCount);
 
 //Funcao que adiciona um endereco ao fim do array de blocos de um i-node
 //Retorna -1 caso a inclusao do endereco nao seja bem sucedida
-//E' a unica funcao que salva automaticamente o i-node em disco
+//E' a unica funcao que salva automaticamente o i-node em disco: apenas o
+//ultimo i-node da cadeia, memorizado na entrada da cache do i-node, e' salvo
+//(e a extensao anterior, quando uma nova e' criada). Em uma copia obtida por
+//inodeLoad, o acrescimo passa pela entrada da cache e a copia recebe os
+//enderecos e o encadeamento resultantes
 int inodeAddBlock (Inode *i, unsigned int blockAddr);
 
 //Funcao que retorna o numero de um i-node.
@@ -97,11 +195,49 @@ unsigned int inodeGetRefCount (Inode *i);
 
 //Funcao que retorna o endereco correspondente a um bloco (blockNum) no array
 //de blocos de um i-node. O i-node precisa ser o primeiro de sua cadeia.
+//Para i-nodes obtidos por inodeGet, a consulta e' feita em tempo constante
+//por um mapa de blocos mantido em memoria, sem acesso ao disco.
 //Retorna 0 se o bloco nao possuir endereco em blockNum
 unsigned int inodeGetBlockAddr (Inode *i, unsigned int blockNum);
 
+//Funcao que retorna o numero de bytes de dados que cabem no proprio i-node,
+//nas posicoes de enderecos de blocos
+unsigned int inodeInlineCapacity ( void );
+
+//Funcao que indica se os dados do arquivo referente a um i-node estao
+//embutidos no proprio i-node. Um i-node com dados embutidos nao tem blocos:
+//inodeGetBlockAddr retorna 0 e inodeAddBlock falha ate' inodeDropInline
+int inodeIsInline (Inode *i);
+
+//Funcao que copia para buf ate' nbytes dos dados embutidos em um i-node, a
+//partir do byte offset. Retorna o numero de bytes copiados ou -1 se o i-node
+//nao tiver dados embutidos
+int inodeReadInline (Inode *i, unsigned int offset, unsigned char *buf,
+                     unsigned int nbytes);
+
+//Funcao que grava nbytes de buf nos dados embutidos em um i-node, a partir do
+//byte offset. Um i-node sem blocos passa a ter dados embutidos. O i-node nao
+//e' salvo. Retorna 0 se bem sucedido ou -1 se o i-node tiver blocos ou se os
+//dados ultrapassarem inodeInlineCapacity
+int inodeWriteInline (Inode *i, unsigned int offset, const unsigned char *buf,
+                      unsigned int nbytes);
+
+//Funcao que descarta os dados embutidos em um i-node, liberando suas posicoes
+//para enderecos de blocos. O i-node nao e' salvo. Retorna 0 se bem sucedido
+//ou -1 se o i-node nao tiver dados embutidos
+int inodeDropInline (Inode *i);
+
 //Funcao que encontra um i-node livre em um disco, a partir do i-node de numero
-//startFrom. Retorna o numero do inode livre encontrado ou 0 se nao encontrado.
+//startFrom. Com mapa de i-nodes livres associado ao disco (inodeAttachFreeMap)
+//a busca e' feita em memoria, em tempo constante, e o i-node encontrado passa
+//a constar como ocupado. Retorna o numero do inode livre encontrado ou 0 se
+//nao encontrado.
 unsigned int inodeFindFreeInode (unsigned int startFrom, Disk *d);
 
+//Funcao que devolve ao mapa de i-nodes livres do disco d o i-node number,
+//obtido por inodeFindFreeInode mas nao ligado ao sistema de arquivos (por
+//falha ao cria-lo ou ao registra-lo). Sem mapa associado ao disco, nada e'
+//feito, pois a busca considera livre todo i-node vazio
+void inodeRelease (unsigned int number, Disk *d);
+
 #endif
@@ -17,7 +17,7 @@
 #include "vfs.h"
 #include "inode.h"
 
-#define MAX_CONNECTEDDISKS 1
+#define MAX_CONNECTEDDISKS 8
 
 #define RESULT_MSGDELAY 1000
 
@@ -32,6 +32,8 @@ typedef struct fd {
 
 Disk *disks[MAX_CONNECTEDDISKS]; //Discos conectados ao sistema
 unsigned int connectedDisks = 0; //Numero de discos conectados
+unsigned int stripeRefs[MAX_CONNECTEDDISKS]; //Discos compostos que usam cada
+					     //disco como membro
 
 Disk *rd = NULL;	//Disco montado como sistema de arquivos raiz 
 int rfsid = NO_ID;	//ID do sistema de arquivo montado como raiz
@@ -101,6 +103,60 @@ void doDiskConnect(char *rawDiskPath) {
 	SLEEP (RESULT_MSGDELAY);
 }
 
+//Interface para montar um disco composto em faixas (RAID-0) sobre discos ja
+//conectados ao sistema operacional hipotetico
+void doDiskStripe (void) {
+	if ( connectedDisks == MAX_CONNECTEDDISKS )
+		printf ("\n!! DiskStripe: FAILED. "
+		        "Maximum number of connected disks reached!\n");
+	else {
+		Disk *members[DISK_STRIPEMAXMEMBERS];
+		int ids[DISK_STRIPEMAXMEMBERS];
+		int id = -1, n, valid = 1;
+		unsigned long stripe;
+		for (int a=0; a<MAX_CONNECTEDDISKS; a++)
+			if (!disks[a]) {
+				id = a;
+				break;
+			}
+		printf ("\n>> DiskStripe: Number of member disks: ");
+		scanf (" %d", &n);
+		if ( n < 1 || n > DISK_STRIPEMAXMEMBERS ) {
+			printf ("\n!! DiskStripe: FAILED. "
+			        "Invalid number of members!\n");
+			SLEEP (RESULT_MSGDELAY);
+			return;
+		}
+		for (int m=0; m<n; m++) {
+			printf (">> DiskStripe: Member #%d disk ID: ", m);
+			scanf (" %d", &ids[m]);
+			if ( ids[m] < 0 || ids[m] > MAX_CONNECTEDDISKS - 1 ||
+			     !disks[ids[m]] || disks[ids[m]] == rd )
+				valid = 0;
+			else members[m] = disks[ids[m]];
+		}
+		printf (">> DiskStripe: Stripe size in # of sectors: ");
+		scanf (" %lu", &stripe);
+		if ( !valid )
+			printf ("\n!! DiskStripe: FAILED. "
+			        "Invalid identifier!\n");
+		else {
+			printf ("\n-- Connecting... "); fflush (stdout);
+			disks[id] = diskConnectStriped (id, members, n, stripe);
+			if (disks[id]) {
+				printf ("Disk %d successfully connected\n", id);
+				connectedDisks++;
+				for (int m=0; m<n; m++)
+					stripeRefs[ids[m]]++;
+			}
+			else
+				printf ("\n!! DiskStripe: FAILED. Repeated "
+				        "members or invalid stripe size!\n");
+		}
+	}
+	SLEEP (RESULT_MSGDELAY);
+}
+
 //Interface para listar dados dos discos atualmente conectados ao sistema
 //operacional hipotetico
 void doDiskList (void) {
@@ -109,15 +165,78 @@ void doDiskList (void) {
 	else {
 		printf ("\n-- DiskList: Listing...\n");
 		for (int id = 0; id<MAX_CONNECTEDDISKS; id++) {
+			if (!disks[id]) continue;
 			printf ("-- DiskID: %d; NumCylinders: %lu; "
 			        "DataSize: %lu\n",
 				id, diskGetNumCylinders(disks[id]),
 				diskGetSize(disks[id]));
+			if (diskGetNumMembers(disks[id])) {
+				printf ("   Striped over disks");
+				for (int m = 0;
+				     m < diskGetNumMembers(disks[id]); m++)
+					printf (" %d", diskGetId (
+					        diskGetMember (disks[id], m)));
+				printf ("; StripeSize: %lu sectors\n",
+				        diskGetStripeSectors(disks[id]));
+			}
 		}
 	}
 	SLEEP(RESULT_MSGDELAY);
 }
 
+//Interface para mostrar as estatisticas de E/S de um disco conectado ao
+//sistema operacional hipotetico, com opcao de zera-las em seguida
+void doDiskStats (void) {
+	if ( !connectedDisks )
+		printf ("\n!! DiskStats: No connected disks!\n");
+	else {
+		int id;
+		printf ("\n>> DiskStats: Disk ID: ");
+		scanf (" %u", &id);
+		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
+			printf ("\n!! DiskStats: FAILED. "
+			        "Invalid identifier!\n");
+		else {
+			DiskStats st;
+			char reset;
+			diskGetStats (disks[id], &st);
+			printf ("\n-- DiskStats: Disk %d\n", id);
+			printf ("-- Reads: %llu ops, %llu sectors; "
+			        "Writes: %llu ops, %llu sectors\n",
+			        st.readOps, st.sectorsRead,
+			        st.writeOps, st.sectorsWritten);
+			printf ("-- Seeks: %llu; Cylinders travelled: %llu\n",
+			        st.seeks, st.cylinders);
+			printf ("-- Busy time: %llu us (simulated); "
+			        "Slept: %llu us\n", st.busyTime, st.sleptTime);
+			printf ("-- Cache: %llu hits, %llu misses\n",
+			        st.cacheHits, st.cacheMisses);
+			for (int op = DISK_IO_READ; op <= DISK_IO_WRITE; op++) {
+				printf ("-- %s latency (us):\n",
+				        op == DISK_IO_READ ? "Read" : "Write");
+				for (int b = 0; b < DISK_STATS_LATBUCKETS; b++) {
+					if (!st.latency[op][b]) continue;
+					if (b == 0)
+						printf ("   %10s  0: %llu\n", "",
+						        st.latency[op][b]);
+					else
+						printf ("   %10llu..%llu: %llu\n",
+						        1ULL << (b-1),
+						        (1ULL << b) - 1,
+						        st.latency[op][b]);
+				}
+			}
+			printf (">> DiskStats: Reset counters (y/n)? ");
+			scanf (" %c", &reset);
+			if (reset == 'y' || reset == 'Y') {
+				diskResetStats (disks[id]);
+				printf ("-- DiskStats: Counters reset\n");
+			}
+		}
+	}
+	SLEEP (RESULT_MSGDELAY);
+}
+
 //Interface para mostrar na saida padrao o conteudo de uma faixa de setores de
 //um disco conectado ao sistema operacional hipotetico
 void doDiskReadPrintSectors (void) {
@@ -181,11 +300,20 @@ void doDiskDisconnect ( int id ) {
 		else if (disks[id] == rd) 
 			printf ("\n!! DiskDisconnect: FAILED. Cannot "
 			        "disconnect the root filesystem disk\n");
+		else if (stripeRefs[id])
+			printf ("\n!! DiskDisconnect: FAILED. Disk is a "
+			        "member of a striped disk\n");
 		else {
+			int ids[DISK_STRIPEMAXMEMBERS];
+			int n = diskGetNumMembers (disks[id]);
+			for (int m=0; m<n; m++)
+				ids[m] = diskGetId (diskGetMember (disks[id], m));
 			printf ("\n-- Disconnecting... "); fflush (stdout);
 			if ( diskDisconnect (disks[id]) > -1 ) {
 				printf ("Disk %d successfully disconnected."
 					"\n", id);
+				for (int m=0; m<n; m++)
+					stripeRefs[ids[m]]--;
 				disks[id] = NULL;
 				connectedDisks--;
 			}
@@ -213,6 +341,9 @@ void doFSFormat (void) {
 		else if (disks[id] == rd) 
 			printf ("\n!! DiskFormat: FAILED. "
 			        "Cannot format the root filesystem disk\n");
+		else if (stripeRefs[id])
+			printf ("\n!! DiskFormat: FAILED. "
+			        "Disk is a member of a striped disk\n");
 		else {
 			int fsid, bs;
 			printf (">> DiskFormat: Filesystem ID: ");
@@ -250,6 +381,9 @@ void doFSMountRoot (void) {
 		if ( id > MAX_CONNECTEDDISKS - 1 || !disks[id])
 			printf ("\n!! MountRoot: FAILED. "
 			        "Invalid identifier!\n");
+		else if (stripeRefs[id])
+			printf ("\n!! MountRoot: FAILED. "
+			        "Disk is a member of a striped disk\n");
 		else {
 			int fsid;
 			printf (">> MountRoot: Filesystem ID: ");
@@ -580,7 +714,11 @@ char sanitizeBeforeQuit () {
 	//Desmontando a raiz do sistema de arquivos
 	if (rd) doFSUnmountRoot();
 
-	//Desconectando discos
+	//Desconectando discos, primeiro os compostos e depois seus membros
+	if (connectedDisks)
+		for (int a=0; a<MAX_CONNECTEDDISKS; a++)
+			if (disks[a] && diskGetNumMembers(disks[a]))
+				doDiskDisconnect(a);
 	if (connectedDisks)
 		for (int a=0; a<MAX_CONNECTEDDISKS; a++)
 			if (disks[a]) doDiskDisconnect(a);
@@ -676,7 +814,9 @@ void diskMenuSelection (void) {
 			  "               Disks: %u / Root Disk: %d\n"
 		          "     [B]uild/rebuild a disk (Low-level format)\n"
 		          "     [C]onnect a disk\n"
+		          "     [A]ssemble a striped disk (RAID-0)\n"
 			  "     [L]ist connected disks\n"
+			  "     [S]tatistics of a disk\n"
 			  "     [R]ead/print sector range from a disk\n"
 		          "     [D]isconnect a disk\n"
 		          "     [<]back to MAIN menu\n"
@@ -687,7 +827,9 @@ void diskMenuSelection (void) {
 		switch (choice) {
 			case 'B': case 'b': doDiskBuild(); break;
 			case 'C': case 'c': doDiskConnect(NULL); break;
+			case 'A': case 'a': doDiskStripe(); break;
 			case 'L': case 'l': doDiskList(); break;
+			case 'S': case 's': doDiskStats(); break;
 			case 'R': case 'r': doDiskReadPrintSectors(); break;
 			case 'D': case 'd': doDiskDisconnect(NO_ID); break;
 		}
@@ -724,8 +866,10 @@ int main (int argc, char* argv[]) {
 
 	installMyFS();
 
-	for (int a=0; a<MAX_CONNECTEDDISKS; a++)
+	for (int a=0; a<MAX_CONNECTEDDISKS; a++) {
 		disks[a] = NULL;
+		stripeRefs[a] = 0;
+	}
 	for (int a=1; a<=MAX_FDS; a++) {
 		fds[a-1].status = 0;
 		fds[a-1].type = 0;
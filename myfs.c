@@ -31,90 +31,519 @@ typedef struct {
     unsigned int inodeNumber;
     unsigned int cursor;
     Disk *d;
+    Inode *inode; // Referencia mantida na cache enquanto o arquivo esta aberto
 } MyFSFileDescriptor; 
 
+// Limite de dados de um arquivo mantidos em um buffer de escrita adiada
+#define MYFS_DELAYEDMAX (256 * 1024)
+
+// Buffer de escrita adiada de um arquivo: dados escritos alem dos blocos ja'
+// alocados ficam em memoria, e os blocos so' sao escolhidos quando o buffer
+// e' gravado, no fechamento do arquivo, no sync ou ao atingir o limite. Os
+// blocos que os dados vao ocupar ficam reservados desde a escrita, para que
+// a gravacao nao fique sem espaco
+typedef struct {
+    Inode *inode;                // I-node do arquivo (NULL: buffer livre)
+    unsigned int start;          // Posicao no arquivo do primeiro byte, no
+                                 // inicio do primeiro bloco nao alocado
+    unsigned char *data;         // Dados a partir de start
+    unsigned int len;            // Bytes de dados
+    unsigned int cap;            // Capacidade de data
+    unsigned int reserved;       // Blocos reservados para os dados
+} MyFSDelayed;
+
+// Estado do sistema de arquivos montado, carregado na montagem e mantido em
+// memoria ate' a desmontagem. Leituras e escritas de arquivos nao acessam o
+// superbloco no disco
+typedef struct {
+    Disk *d;                     // Disco montado (NULL: nenhum)
+    Superblock sb;               // Copia do superbloco
+    int sbDirty;                 // Superbloco alterado e ainda nao gravado
+
+    // Mapa de blocos livres: o bit k da palavra w indica se o bloco
+    // w * 64 + k esta' ocupado. Bits alem de numBlocks ficam sempre ocupados
+    unsigned long long *blockMap;
+    unsigned int blockMapWords;
+    unsigned char *blockMapDirty; // Setores do mapa alterados
+    unsigned int blockMapCursor;  // Palavra onde a busca comeca
+    unsigned long freeBlocks;     // Blocos livres no mapa
+    unsigned long reservedBlocks; // Blocos livres reservados para buffers
+                                  // de escrita adiada
+
+    MyFSDelayed delayed[MAX_FDS]; // Buffers de escrita adiada, por i-node
+} MyFSState;
+
 static MyFSFileDescriptor fdTable[MAX_FDS];
 static unsigned int openCount = 0;
-static Superblock sb;
+static MyFSState fs;
+static unsigned int formatFlags = 0;
+
+// Campos do superbloco, na ordem em que sao gravados no setor 0
+#define SUPERBLOCK_NUMFIELDS 9
 
 static int __saveSuperblock(Disk *d, Superblock *sb) {
     unsigned char sector[DISK_SECTORDATASIZE];
     memset(sector, 0, DISK_SECTORDATASIZE);
     
-    unsigned char *ptr = sector;
-    ul2char(sb->magic, (unsigned char*)ptr); ptr += sizeof(unsigned int);
-    ul2char(sb->blockSize, (unsigned char*)ptr); ptr += sizeof(unsigned int);
-    ul2char(sb->numBlocks, (unsigned char*)ptr); ptr += sizeof(unsigned int);
-    ul2char(sb->freeMapSector, (unsigned char*)ptr); ptr += sizeof(unsigned int);
-    ul2char(sb->freeMapSize, (unsigned char*)ptr); ptr += sizeof(unsigned int);
-    ul2char(sb->dataStartSector, (unsigned char*)ptr); ptr += sizeof(unsigned int);
-    ul2char(sb->rootInode, (unsigned char*)ptr); ptr += sizeof(unsigned int);
+    unsigned int fields[SUPERBLOCK_NUMFIELDS] = {
+        sb->magic, sb->blockSize, sb->numBlocks, sb->freeMapSector,
+        sb->freeMapSize, sb->dataStartSector, sb->rootInode, sb->flags,
+        sb->inodeTableInit
+    };
+    ul2chars(fields, sector, SUPERBLOCK_NUMFIELDS);
     
     return diskWriteSector(d, 0, sector);
 }
 
 static int __loadSuperblock(Disk *d, Superblock *sb) {
     unsigned char sector[DISK_SECTORDATASIZE];
+    unsigned int fields[SUPERBLOCK_NUMFIELDS];
     
     if (diskReadSector(d, 0, sector) < 0) return -1;
     
-    unsigned char *ptr = sector;
-    char2ul(ptr, &sb->magic); ptr += sizeof(unsigned int);
-    char2ul(ptr, &sb->blockSize); ptr += sizeof(unsigned int);
-    char2ul(ptr, &sb->numBlocks); ptr += sizeof(unsigned int);
-    char2ul(ptr, &sb->freeMapSector); ptr += sizeof(unsigned int);
-    char2ul(ptr, &sb->freeMapSize); ptr += sizeof(unsigned int);
-    char2ul(ptr, &sb->dataStartSector); ptr += sizeof(unsigned int);
-    char2ul(ptr, &sb->rootInode); ptr += sizeof(unsigned int);
+    char2uls(sector, fields, SUPERBLOCK_NUMFIELDS);
+    sb->magic = fields[0];
+    sb->blockSize = fields[1];
+    sb->numBlocks = fields[2];
+    sb->freeMapSector = fields[3];
+    sb->freeMapSize = fields[4];
+    sb->dataStartSector = fields[5];
+    sb->rootInode = fields[6];
+    sb->flags = fields[7];
+    sb->inodeTableInit = fields[8];
     
     return 0;
 }
 
-static unsigned int __allocBlock(Disk *d, Superblock *sb) {
-    unsigned char buffer[DISK_SECTORDATASIZE];
-    unsigned int totalBits = sb->numBlocks;
-    unsigned int bitCounter = 0;
+// O mapa de i-nodes livres so' e' declarado valido no disco enquanto nao ha'
+// alteracoes dele ainda nao gravadas. Antes da primeira operacao que pode
+// alocar i-nodes desde a montagem ou o ultimo sync, o superbloco no disco
+// deixa de declara-lo valido, para que a montagem que segue uma queda o
+// reconstrua a partir da tabela de i-nodes
+static int __invalidateInodeMap(Disk *d) {
+    if (!(fs.sb.flags & MYFS_FLAG_INODEMAP)) return 0;
+
+    fs.sb.flags &= ~MYFS_FLAG_INODEMAP;
+    if (__saveSuperblock(d, &fs.sb) < 0) {
+        fs.sb.flags |= MYFS_FLAG_INODEMAP;
+        return -1;
+    }
+    return 0;
+}
+
+// Na formatacao rapida, a marca da tabela de i-nodes inicializada avanca no
+// superbloco antes que o primeiro i-node alem dela seja gravado, pela mesma
+// razao: a montagem que segue uma queda le como vazios os setores alem da
+// marca gravada
+static int __saveInodeTableInit(Disk *d, unsigned int initSectors) {
+    unsigned int old = fs.sb.inodeTableInit;
+
+    fs.sb.inodeTableInit = initSectors;
+    if (__saveSuperblock(d, &fs.sb) < 0) {
+        fs.sb.inodeTableInit = old;
+        return -1;
+    }
+    return 0;
+}
+
+// Libera o buffer de uma escrita assincrona ao fim dela. Uma falha nao e'
+// tratada aqui: ela fica registrada no disco e e' reportada por diskAsyncWait
+static void __freeOnCompletion(void *arg, int result) {
+    (void)result;
+    free(arg);
+}
+
+// Retorna o indice do bit 0 menos significativo de uma palavra que nao tem
+// todos os bits em 1
+static int __firstZeroBit(unsigned long long w) {
+#ifdef __GNUC__
+    return __builtin_ctzll(~w);
+#else
+    int b = 0;
+    while (w & 1) {
+        w >>= 1;
+        b++;
+    }
+    return b;
+#endif
+}
+
+static void __freeBlockMap(void) {
+    free(fs.blockMap);
+    free(fs.blockMapDirty);
+    fs.blockMap = NULL;
+    fs.blockMapDirty = NULL;
+    fs.blockMapWords = 0;
+    fs.blockMapCursor = 0;
+    fs.freeBlocks = 0;
+    fs.reservedBlocks = 0;
+}
+
+static int __loadBlockMap(Disk *d, Superblock *sb) {
+    unsigned long bytes = (unsigned long)sb->freeMapSize * DISK_SECTORDATASIZE;
+    unsigned char *buffer = malloc(bytes);
+
+    __freeBlockMap();
+    fs.blockMapWords = bytes / sizeof(unsigned long long);
+    fs.blockMap = calloc(fs.blockMapWords, sizeof(unsigned long long));
+    fs.blockMapDirty = calloc(sb->freeMapSize, 1);
+    if (!buffer || !fs.blockMap || !fs.blockMapDirty ||
+        diskReadSectors(d, sb->freeMapSector, sb->freeMapSize, buffer) < 0) {
+        free(buffer);
+        __freeBlockMap();
+        return -1;
+    }
+
+    for (unsigned long i = 0; i < bytes; i++) {
+        fs.blockMap[i / 8] |= (unsigned long long)buffer[i] << (i % 8 * 8);
+    }
+    for (unsigned long b = sb->numBlocks; b < (unsigned long)fs.blockMapWords * 64; b++) {
+        fs.blockMap[b / 64] |= 1ULL << (b % 64);
+    }
+    for (unsigned int w = 0; w < fs.blockMapWords; w++) {
+        for (unsigned long long z = ~fs.blockMap[w]; z; z &= z - 1) fs.freeBlocks++;
+    }
+    free(buffer);
+    return 0;
+}
+
+// Grava os setores alterados do mapa de blocos livres, agrupando setores
+// vizinhos em uma unica escrita
+static int __saveBlockMap(Disk *d, Superblock *sb) {
+    if (!fs.blockMap) return 0;
 
     for (unsigned int s = 0; s < sb->freeMapSize; s++) {
-        if (diskReadSector(d, sb->freeMapSector + s, buffer) < 0) return 0;
-        
-        for (int i = 0; i < DISK_SECTORDATASIZE; i++) {
-            for (int bit = 0; bit < 8; bit++) {
-                if (bitCounter >= totalBits) return 0; 
-                
-                if (!((buffer[i] >> bit) & 1)) {
-                    buffer[i] |= (1 << bit);
-                    diskWriteSector(d, sb->freeMapSector + s, buffer);
-                    
-                    unsigned int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
-                    return sb->dataStartSector + (bitCounter * sectorsPerBlock);
-                }
-                bitCounter++;
+        if (!fs.blockMapDirty[s]) continue;
+
+        unsigned int e = s;
+        while (e < sb->freeMapSize && fs.blockMapDirty[e]) e++;
+
+        unsigned char *buffer = malloc((unsigned long)(e - s) * DISK_SECTORDATASIZE);
+        if (!buffer) return -1;
+        for (unsigned long a = 0; a < (unsigned long)(e - s) * DISK_SECTORDATASIZE; a++) {
+            unsigned long i = (unsigned long)s * DISK_SECTORDATASIZE + a;
+            buffer[a] = (unsigned char)(fs.blockMap[i / 8] >> (i % 8 * 8));
+            // Bits alem do ultimo bloco continuam livres no disco
+            if (i * 8 + 8 > sb->numBlocks) {
+                unsigned long keep = (sb->numBlocks > i * 8) ? sb->numBlocks - i * 8 : 0;
+                buffer[a] &= (unsigned char)((1u << keep) - 1);
             }
         }
+        int ret = diskWriteSectors(d, sb->freeMapSector + s, e - s, buffer);
+        free(buffer);
+        if (ret < 0) return -1;
+
+        memset(fs.blockMapDirty + s, 0, e - s);
+        s = e;
     }
     return 0;
 }
 
+// Marca count blocos a partir do bloco first como ocupados (used nao nulo)
+// ou livres no mapa em memoria
+static void __markBlocks(unsigned long first, unsigned long count, int used) {
+    for (unsigned long b = first; b < first + count; b++) {
+        unsigned long long bit = 1ULL << (b % 64);
+        if (used && !(fs.blockMap[b / 64] & bit)) {
+            fs.blockMap[b / 64] |= bit;
+            fs.freeBlocks--;
+        } else if (!used && (fs.blockMap[b / 64] & bit)) {
+            fs.blockMap[b / 64] &= ~bit;
+            fs.freeBlocks++;
+        }
+        fs.blockMapDirty[b / 8 / DISK_SECTORDATASIZE] = 1;
+    }
+}
+
+// O mapa de blocos livres so' vai para o disco no sync e na desmontagem, mas
+// i-nodes e diretorios sao gravados no fechamento e no despejo da cache. Sem
+// uma desmontagem limpa, o mapa no disco pode dar como livres blocos de
+// arquivos ja' gravados; ele e' entao refeito a partir dos blocos de todos
+// os i-nodes em uso. Retorna 0 se bem sucedido ou -1 caso contrario
+static int __rebuildBlockMap(Disk *d, Superblock *sb) {
+    unsigned int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
+
+    __markBlocks(0, sb->numBlocks, 0);
+    for (unsigned int n = 1; n <= MAX_INODES; n++) {
+        Inode *inode = inodeGet(n, d);
+        if (!inode) return -1;
+
+        // Extensoes nao tem tipo: seus blocos sao alcancados pela cadeia
+        // do i-node principal
+        if (inodeGetFileType(inode) != 0) {
+            unsigned int addr;
+            for (unsigned int b = 0; (addr = inodeGetBlockAddr(inode, b)) != 0; b++) {
+                if (addr < sb->dataStartSector) continue;
+                unsigned long block = (addr - sb->dataStartSector) / sectorsPerBlock;
+                if (block < sb->numBlocks) __markBlocks(block, 1, 1);
+            }
+        }
+        inodePut(inode);
+    }
+    return 0;
+}
+
+// Aloca ate' want blocos contiguos, de preferencia uma sequencia livre com
+// want blocos ou, se nao houver, a maior sequencia livre. A busca comeca na
+// palavra onde a ultima alocacao terminou, pula palavras inteiramente
+// ocupadas ou livres de uma vez e, dentro de uma palavra, salta os blocos
+// ocupados ate' o proximo livre. Blocos reservados para buffers de escrita
+// adiada nao sao alocados. Retorna o endereco do primeiro bloco e coloca em
+// got o numero de blocos alocados, ou retorna 0 se nao houver blocos livres
+static unsigned int __allocBlocks(Superblock *sb, unsigned int want, unsigned int *got) {
+    unsigned long total = (unsigned long)fs.blockMapWords * 64;
+    unsigned long start = (unsigned long)fs.blockMapCursor * 64;
+    unsigned long runStart = 0, runLen = 0, bestStart = 0, bestLen = 0;
+
+    *got = 0;
+    if (!fs.blockMap) return 0;
+    if (want > fs.freeBlocks - fs.reservedBlocks) want = fs.freeBlocks - fs.reservedBlocks;
+    if (want == 0) return 0;
+
+    for (unsigned long k = 0; k < total && bestLen < want; ) {
+        unsigned long b = (start + k) % total;
+        unsigned long long w = fs.blockMap[b / 64];
+
+        // Sequencias nao continuam do fim do mapa para o inicio
+        if (b == 0) runLen = 0;
+        if (b % 64 == 0 && (w == ~0ULL || w == 0)) {
+            if (w) runLen = 0;
+            else {
+                if (runLen == 0) runStart = b;
+                runLen += 64;
+            }
+            k += 64;
+        } else if (runLen == 0 && ((w >> (b % 64)) & 1)) {
+            // Fora de uma sequencia, salta direto para o proximo bloco livre
+            // da palavra, ou para a proxima palavra se nao houver
+            unsigned long long rest = w | ((1ULL << (b % 64)) - 1);
+            k += (rest == ~0ULL ? 64 : (unsigned long)__firstZeroBit(rest)) - b % 64;
+        } else {
+            if ((w >> (b % 64)) & 1) runLen = 0;
+            else {
+                if (runLen == 0) runStart = b;
+                runLen++;
+            }
+            k++;
+        }
+        if (runLen > bestLen) {
+            bestStart = runStart;
+            bestLen = runLen;
+        }
+    }
+    if (bestLen == 0) return 0;
+    if (bestLen > want) bestLen = want;
+
+    __markBlocks(bestStart, bestLen, 1);
+    fs.blockMapCursor = (bestStart + bestLen - 1) / 64;
+    *got = bestLen;
+
+    unsigned int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
+    return sb->dataStartSector + (bestStart * sectorsPerBlock);
+}
+
+// Devolve ao mapa count blocos contiguos a partir do endereco blockAddr
+static void __freeBlocks(Superblock *sb, unsigned int blockAddr, unsigned int count) {
+    unsigned int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
+    if (!fs.blockMap || count == 0) return;
+    __markBlocks((blockAddr - sb->dataStartSector) / sectorsPerBlock, count, 0);
+}
+
+// Aloca um bloco livre
+static unsigned int __allocBlock(Superblock *sb) {
+    unsigned int got;
+    return __allocBlocks(sb, 1, &got);
+}
+
+// Acrescenta count blocos ao fim de um arquivo, em sequencias contiguas tao
+// longas quanto possivel, gravando cada sequencia com uma unica escrita: com
+// o conteudo dos blocos, em data (count blocos), ou com zeros se data for
+// NULL. Retorna o numero de blocos acrescentados, que so' e' menor que count
+// se faltar espaco, ou -1 em caso de falha
+static int __extendFile(Disk *d, Inode *inode, Superblock *sb, unsigned int count,
+                        const unsigned char *data) {
+    int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
+    unsigned int added = 0;
+
+    // Novos blocos podem exigir i-nodes de extensao
+    if (__invalidateInodeMap(d) < 0) {
+        return -1;
+    }
+
+    while (added < count) {
+        unsigned int got;
+        unsigned int first = __allocBlocks(sb, count - added, &got);
+        if (first == 0) break;
+
+        unsigned char *cleanBuf = NULL;
+        const unsigned char *runData = data ? data + (unsigned long)added * sb->blockSize : NULL;
+        if (!runData) runData = cleanBuf = calloc(got, sb->blockSize);
+        if (!runData ||
+            diskWriteSectors(d, first, (unsigned long)got * sectorsPerBlock,
+                             (unsigned char*)runData) < 0) {
+            free(cleanBuf);
+            __freeBlocks(sb, first, got);
+            return (added > 0 ? (int)added : -1);
+        }
+        free(cleanBuf);
+
+        for (unsigned int i = 0; i < got; i++) {
+            if (inodeAddBlock(inode, first + i * sectorsPerBlock) < 0) {
+                __freeBlocks(sb, first + i * sectorsPerBlock, got - i);
+                return (added > 0 ? (int)added : -1);
+            }
+            added++;
+        }
+    }
+    return added;
+}
+
+// Retorna o buffer de escrita adiada do i-node, ou NULL se nao houver
+static MyFSDelayed* __findDelayed(Inode *inode) {
+    for (int i = 0; i < MAX_FDS; i++) {
+        if (fs.delayed[i].inode == inode) return &fs.delayed[i];
+    }
+    return NULL;
+}
+
+// Descarta um buffer de escrita adiada, devolvendo a sua reserva de blocos
+static void __dropDelayed(MyFSDelayed *dl) {
+    fs.reservedBlocks -= dl->reserved;
+    free(dl->data);
+    memset(dl, 0, sizeof(MyFSDelayed));
+}
+
+// Grava os dados de um buffer de escrita adiada: os blocos que eles ocupam
+// sao alocados so' agora, de uma vez e contiguos sempre que possivel, e
+// recebem os dados diretamente. Em caso de falha, os dados dos blocos nao
+// gravados continuam no buffer, com a sua reserva. Retorna 0 se bem sucedido
+// ou -1 caso contrario
+static int __flushDelayed(Disk *d, MyFSDelayed *dl) {
+    Superblock *sb = &fs.sb;
+    unsigned int count = (dl->len + sb->blockSize - 1) / sb->blockSize;
+
+    // A reserva do buffer e' consumida pela propria alocacao. A capacidade
+    // do buffer e' sempre multipla do tamanho do bloco, e o fim do ultimo
+    // bloco, alem dos dados, ja' esta' zerado
+    fs.reservedBlocks -= dl->reserved;
+    dl->reserved = 0;
+    int added = (count > 0 ? __extendFile(d, dl->inode, sb, count, dl->data) : 0);
+    if (added < 0) added = 0;
+
+    if ((unsigned int)added < count) {
+        unsigned int done = added * sb->blockSize;
+        memmove(dl->data, dl->data + done, dl->len - done);
+        memset(dl->data + dl->len - done, 0, done);
+        dl->start += done;
+        dl->len -= done;
+        dl->reserved = count - added;
+        fs.reservedBlocks += dl->reserved;
+        return -1;
+    }
+
+    __dropDelayed(dl);
+    return 0;
+}
+
+// Grava todos os buffers de escrita adiada do disco montado
+static int __flushAllDelayed(Disk *d) {
+    int ret = 0;
+    for (int i = 0; i < MAX_FDS; i++) {
+        if (fs.delayed[i].inode && __flushDelayed(d, &fs.delayed[i]) < 0) ret = -1;
+    }
+    return ret;
+}
+
+// Copia ate' nbytes de buf para o buffer de escrita adiada de um i-node, na
+// posicao cursor do arquivo, criando o buffer a partir do bloco logico
+// firstBlock se ainda nao existir. Os blocos que os dados vao ocupar sao
+// reservados, e so' sao aceitos os bytes que cabem nos blocos livres.
+// Retorna o numero de bytes copiados ou -1 em caso de falha
+static int __bufferDelayed(Inode *inode, unsigned int firstBlock, unsigned int cursor,
+                           const char *buf, unsigned int nbytes) {
+    unsigned int blockSize = fs.sb.blockSize;
+    MyFSDelayed *dl = __findDelayed(inode);
+    unsigned int start = (dl ? dl->start : firstBlock * blockSize);
+    unsigned long limit = ((dl ? dl->reserved : 0) +
+                           fs.freeBlocks - fs.reservedBlocks) * blockSize;
+
+    if (cursor - start >= limit) return 0;
+    if (nbytes > limit - (cursor - start)) nbytes = limit - (cursor - start);
+
+    if (!dl) {
+        dl = __findDelayed(NULL);
+        if (!dl) return -1;
+        dl->inode = inode;
+        dl->start = start;
+    }
+
+    unsigned int end = cursor - dl->start + nbytes;
+    if (end > dl->cap) {
+        unsigned int cap = dl->cap ? dl->cap : blockSize;
+        while (cap < end) cap *= 2;
+        unsigned char *grown = realloc(dl->data, cap);
+        if (!grown) {
+            if (dl->len == 0) __dropDelayed(dl);
+            return -1;
+        }
+        memset(grown + dl->cap, 0, cap - dl->cap);
+        dl->data = grown;
+        dl->cap = cap;
+    }
+    memcpy(dl->data + (cursor - dl->start), buf, nbytes);
+    if (end > dl->len) dl->len = end;
+
+    unsigned int blocks = (dl->len + blockSize - 1) / blockSize;
+    fs.reservedBlocks += blocks - dl->reserved;
+    dl->reserved = blocks;
+    return nbytes;
+}
+
+// Move os dados embutidos no i-node de um arquivo para um bloco novo, que
+// passa a ser o primeiro bloco do arquivo
+static int __spillInline(Disk *d, Inode *inode, Superblock *sb) {
+    unsigned int fileSize = inodeGetFileSize(inode);
+    int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
+    unsigned char *blockBuffer = calloc(1, sb->blockSize);
+    if (!blockBuffer) return -1;
+
+    inodeReadInline(inode, 0, blockBuffer, fileSize);
+    unsigned int blockAddr = __allocBlock(sb);
+    if (blockAddr == 0 ||
+        diskWriteSectors(d, blockAddr, sectorsPerBlock, blockBuffer) < 0) {
+        free(blockBuffer);
+        return -1;
+    }
+
+    inodeDropInline(inode);
+    if (inodeAddBlock(inode, blockAddr) < 0) {
+        inodeWriteInline(inode, 0, blockBuffer, fileSize);
+        free(blockBuffer);
+        return -1;
+    }
+    free(blockBuffer);
+    return 0;
+}
+
 static unsigned int __findInodeInDir(Disk *d, unsigned int dirInodeNum, const char *filename) {
-    Inode *dirInode = inodeLoad(dirInodeNum, d);
+    Inode *dirInode = inodeGet(dirInodeNum, d);
     if (!dirInode) return 0;
     
     if (inodeGetFileType(dirInode) != FILETYPE_DIR) {
-        free(dirInode);
+        inodePut(dirInode);
         return 0;
     }
     
     unsigned int dirSize = inodeGetFileSize(dirInode);
     if (dirSize == 0) {
-        free(dirInode);
+        inodePut(dirInode);
         return 0;
     }
     
     unsigned int entrySize = sizeof(unsigned int) + MAX_FILENAME_LENGTH + 1;
     unsigned int numEntries = dirSize / entrySize;
     
-    unsigned int blockSize = sb.blockSize;
+    unsigned int blockSize = fs.sb.blockSize;
     
     for (unsigned int i = 0; i < numEntries; i++) {
         unsigned int offset = i * entrySize;
@@ -148,26 +577,26 @@ static unsigned int __findInodeInDir(Disk *d, unsigned int dirInodeNum, const ch
         unsigned int inodeNum;
         char entryName[MAX_FILENAME_LENGTH + 1];
         
-        char2ul(entryBuffer, &inodeNum);
+        char2uls(entryBuffer, &inodeNum, 1);
         memcpy(entryName, entryBuffer + sizeof(unsigned int), MAX_FILENAME_LENGTH + 1);
         entryName[MAX_FILENAME_LENGTH] = '\0';
         
         if (strcmp(entryName, filename) == 0) {
-            free(dirInode);
+            inodePut(dirInode);
             return inodeNum;
         }
     }
     
-    free(dirInode);
+    inodePut(dirInode);
     return 0;
 }
 
 static int __addEntryToDir(Disk *d, unsigned int dirInodeNum, unsigned int fileInodeNum, const char *filename, Superblock *sb) {
-    Inode *dirInode = inodeLoad(dirInodeNum, d);
+    Inode *dirInode = inodeGet(dirInodeNum, d);
     if (!dirInode) return -1;
     
     if (inodeGetFileType(dirInode) != FILETYPE_DIR) {
-        free(dirInode);
+        inodePut(dirInode);
         return -1;
     }
     
@@ -175,7 +604,7 @@ static int __addEntryToDir(Disk *d, unsigned int dirInodeNum, unsigned int fileI
     unsigned char entryBuffer[entrySize];
     memset(entryBuffer, 0, entrySize);
     
-    ul2char(fileInodeNum, entryBuffer);
+    ul2chars(&fileInodeNum, entryBuffer, 1);
     strncpy((char*)(entryBuffer + sizeof(unsigned int)), filename, MAX_FILENAME_LENGTH);
     
     unsigned int dirSize = inodeGetFileSize(dirInode);
@@ -189,48 +618,44 @@ static int __addEntryToDir(Disk *d, unsigned int dirInodeNum, unsigned int fileI
         unsigned int blockAddr = inodeGetBlockAddr(dirInode, blockNum);
         
         if (blockAddr == 0) {
-            blockAddr = __allocBlock(d, sb);
+            blockAddr = __allocBlock(sb);
             if (blockAddr == 0) {
-                free(dirInode);
+                inodePut(dirInode);
                 return -1;
             }
             
             if (inodeAddBlock(dirInode, blockAddr) < 0) {
-                free(dirInode);
+                inodePut(dirInode);
                 return -1;
             }
             
             unsigned char *cleanBuf = calloc(1, sb->blockSize);
             if (!cleanBuf) {
-                free(dirInode);
+                inodePut(dirInode);
                 return -1;
             }
             
             int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
-            for (int k = 0; k < sectorsPerBlock; k++) {
-                if (diskWriteSector(d, blockAddr + k, cleanBuf + (k * DISK_SECTORDATASIZE)) < 0) {
-                    free(cleanBuf);
-                    free(dirInode);
-                    return -1;
-                }
+            if (diskWriteSectors(d, blockAddr, sectorsPerBlock, cleanBuf) < 0) {
+                free(cleanBuf);
+                inodePut(dirInode);
+                return -1;
             }
             free(cleanBuf);
         }
         
         unsigned char *blockBuffer = malloc(sb->blockSize);
         if (!blockBuffer) {
-            free(dirInode);
+            inodePut(dirInode);
             return -1;
         }
         
         int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
         
-        for (int k = 0; k < sectorsPerBlock; k++) {
-            if (diskReadSector(d, blockAddr + k, blockBuffer + (k * DISK_SECTORDATASIZE)) < 0) {
-                free(blockBuffer);
-                free(dirInode);
-                return -1;
-            }
+        if (diskReadSectors(d, blockAddr, sectorsPerBlock, blockBuffer) < 0) {
+            free(blockBuffer);
+            inodePut(dirInode);
+            return -1;
         }
         
         unsigned int spaceInBlock = sb->blockSize - blockOffset;
@@ -239,12 +664,10 @@ static int __addEntryToDir(Disk *d, unsigned int dirInodeNum, unsigned int fileI
         
         memcpy(blockBuffer + blockOffset, entryBuffer + bytesWritten, toCopy);
         
-        for (int k = 0; k < sectorsPerBlock; k++) {
-            if (diskWriteSector(d, blockAddr + k, blockBuffer + (k * DISK_SECTORDATASIZE)) < 0) {
-                free(blockBuffer);
-                free(dirInode);
-                return -1;
-            }
+        if (diskWriteSectors(d, blockAddr, sectorsPerBlock, blockBuffer) < 0) {
+            free(blockBuffer);
+            inodePut(dirInode);
+            return -1;
         }
         
         free(blockBuffer);
@@ -255,11 +678,11 @@ static int __addEntryToDir(Disk *d, unsigned int dirInodeNum, unsigned int fileI
     
     inodeSetFileSize(dirInode, dirSize + entrySize);
     if (inodeSave(dirInode) < 0) {
-        free(dirInode);
+        inodePut(dirInode);
         return -1;
     }
     
-    free(dirInode);
+    inodePut(dirInode);
     return 0;
 }
 
@@ -273,10 +696,25 @@ int myFSIsIdle (Disk *d) {
     return 1;
 }
 
+int myFSSetFormatFlags (unsigned int flags) {
+    if (flags & ~MYFS_KNOWN_FLAGS) {
+        return -1;
+    }
+    formatFlags = flags;
+    return 0;
+}
+
 int myFSFormat (Disk *d, unsigned int blockSize) {
+    return myFSFormatEx(d, blockSize, formatFlags);
+}
+
+int myFSFormatEx (Disk *d, unsigned int blockSize, unsigned int flags) {
     if (blockSize == 0 || (blockSize % DISK_SECTORDATASIZE != 0)) {
         return -1;
     }
+    if (flags & ~MYFS_KNOWN_FLAGS) {
+        return -1;
+    }
 
     unsigned long totalSectors = diskGetNumSectors(d);
 
@@ -311,33 +749,64 @@ int myFSFormat (Disk *d, unsigned int blockSize) {
     
     numBlocks = ((totalSectors - dataStartSector) * DISK_SECTORDATASIZE) / blockSize;
 
-    unsigned int inodesPerSector = DISK_SECTORDATASIZE / (16 * sizeof(unsigned int));
-    unsigned long inodeAreaBegin = inodeAreaBeginSector();
+    // A tabela de i-nodes e' reescrita diretamente no disco, entao i-nodes
+    // deste disco ainda na cache deixam de valer
+    inodeCacheInvalidate(d);
+
+    // Na formatacao rapida, a tabela de i-nodes nao e' gravada agora: seus
+    // setores sao inicializados no primeiro uso
+    if (!(flags & MYFS_FLAG_LAZYINODES)) {
+        unsigned int inodesPerSector = DISK_SECTORDATASIZE / (16 * sizeof(unsigned int));
+        unsigned long inodeAreaBegin = inodeAreaBeginSector();
     
-    for (unsigned long sectorIdx = 0; sectorIdx < inodeTableSectors; sectorIdx++) {
-        unsigned char sector[DISK_SECTORDATASIZE];
-        memset(sector, 0, DISK_SECTORDATASIZE);
+        unsigned char *inodeTable = calloc(inodeTableSectors, DISK_SECTORDATASIZE);
+        if (!inodeTable) {
+            return -1;
+        }
+
+        for (unsigned long sectorIdx = 0; sectorIdx < inodeTableSectors; sectorIdx++) {
+            unsigned char *sector = inodeTable + sectorIdx * DISK_SECTORDATASIZE;
         
-        for (unsigned int j = 0; j < inodesPerSector; j++) {
-            unsigned int inodeNum = sectorIdx * inodesPerSector + j + 1;
-            if (inodeNum > MAX_INODES) break;
+            for (unsigned int j = 0; j < inodesPerSector; j++) {
+                unsigned int inodeNum = sectorIdx * inodesPerSector + j + 1;
+                if (inodeNum > MAX_INODES) break;
             
-            unsigned int offset = j * 16 * sizeof(unsigned int);
+                unsigned int offset = j * 16 * sizeof(unsigned int);
             
-            ul2char(inodeNum, &sector[offset + 14 * sizeof(unsigned int)]);
+                ul2char(inodeNum, &sector[offset + 14 * sizeof(unsigned int)]);
+            }
         }
-        
-        if (diskWriteSector(d, inodeAreaBegin + sectorIdx, sector) < 0) {
+
+        int ret = diskWriteSectors(d, inodeAreaBegin, inodeTableSectors, inodeTable);
+        free(inodeTable);
+        if (ret < 0) {
             return -1;
         }
     }
+    else if (inodeAttachLazyTable(d, 0, inodeTableSectors, NULL) < 0) {
+        return -1;
+    }
 
-    unsigned char emptySector[DISK_SECTORDATASIZE];
-    memset(emptySector, 0, DISK_SECTORDATASIZE);
-    for (unsigned long i = 0; i < bitmapSectors; i++) {
-        diskWriteSector(d, freeMapStartSector + i, emptySector);
+    unsigned char *emptyMap = calloc(bitmapSectors, DISK_SECTORDATASIZE);
+    if (!emptyMap) {
+        inodeDetachLazyTable(d);
+        return -1;
+    }
+    int ret = diskWriteSectors(d, freeMapStartSector, bitmapSectors, emptyMap);
+    free(emptyMap);
+    if (ret < 0) {
+        inodeDetachLazyTable(d);
+        return -1;
     }
 
+    // Mapa de i-nodes livres: todos livres, ate' a criacao da raiz abaixo
+    unsigned char emptyInodeMap[DISK_SECTORDATASIZE] = {0};
+    if (diskWriteSector(d, MYFS_INODEMAP_SECTOR, emptyInodeMap) < 0) {
+        inodeDetachLazyTable(d);
+        return -1;
+    }
+    flags |= MYFS_FLAG_INODEMAP;
+
     Superblock sb;
     sb.magic = MYFS_MAGIC;
     sb.blockSize = blockSize;
@@ -346,13 +815,17 @@ int myFSFormat (Disk *d, unsigned int blockSize) {
     sb.freeMapSize = bitmapSectors;
     sb.dataStartSector = dataStartSector;
     sb.rootInode = 1;
+    sb.flags = flags;
 
-    if (__saveSuperblock(d, &sb) < 0) {
+    if (inodeAttachFreeMap(d, MYFS_INODEMAP_SECTOR, MAX_INODES, 0) < 0) {
+        inodeDetachLazyTable(d);
         return -1;
     }
 
     Inode *root = inodeCreate(1, d);
     if (!root) {
+        inodeDetachFreeMap(d);
+        inodeDetachLazyTable(d);
         return -1;
     }
     
@@ -361,21 +834,99 @@ int myFSFormat (Disk *d, unsigned int blockSize) {
     inodeSetFileSize(root, 0); 
     
     if (inodeSave(root) < 0) {
-         free(root);
+         inodePut(root);
+         inodeDetachFreeMap(d);
+         inodeDetachLazyTable(d);
          return -1;
     }
-    free(root);
+    inodePut(root);
+
+    // O superbloco registra ate' onde a tabela foi inicializada pela raiz
+    sb.inodeTableInit = (flags & MYFS_FLAG_LAZYINODES) ? inodeGetLazyTableInit(d)
+                                                       : inodeTableSectors;
+    inodeDetachLazyTable(d);
+
+    if (inodeDetachFreeMap(d) < 0) {
+        return -1;
+    }
+
+    if (__saveSuperblock(d, &sb) < 0) {
+        return -1;
+    }
 
     return numBlocks;
 }
 
 int myFSxMount (Disk *d, int x) {
     if (x == 1) { 
-        if (__loadSuperblock(d, &sb) < 0) {
+        if (__loadSuperblock(d, &fs.sb) < 0) {
             return 0;
         }
 
-        if (sb.magic != MYFS_MAGIC) {
+        if (fs.sb.magic != MYFS_MAGIC) {
+            return 0;
+        }
+
+        if (fs.sb.flags & ~MYFS_KNOWN_FLAGS) {
+            return 0;
+        }
+
+        inodeCacheInvalidate(d);
+        if (inodeSetLayout(d, (fs.sb.flags & MYFS_FLAG_EXTENTS) ? INODE_LAYOUT_EXTENTS
+                                                                : INODE_LAYOUT_BLOCKS,
+                           fs.sb.blockSize / DISK_SECTORDATASIZE) < 0) {
+            return 0;
+        }
+
+        // Na formatacao rapida, setores da tabela de i-nodes alem da marca
+        // gravada no superbloco ainda nao foram inicializados
+        if ((fs.sb.flags & MYFS_FLAG_LAZYINODES) &&
+            inodeAttachLazyTable(d, fs.sb.inodeTableInit,
+                                 fs.sb.freeMapSector - inodeAreaBeginSector(),
+                                 __saveInodeTableInit) < 0) {
+            inodeSetLayout(d, INODE_LAYOUT_BLOCKS, 0);
+            return 0;
+        }
+
+        // Discos sem o mapa de i-nodes livres valido, seja por terem sido
+        // formatados sem ele ou desmontados sem sync, tem o mapa reconstruido
+        // a partir da tabela de i-nodes. Enquanto o sistema estiver montado,
+        // o superbloco no disco nao declara o mapa valido; ele volta a valer
+        // no sync e na desmontagem, depois que o mapa for gravado
+        int unclean = !(fs.sb.flags & MYFS_FLAG_INODEMAP);
+        if (inodeAttachFreeMap(d, MYFS_INODEMAP_SECTOR, MAX_INODES, unclean) < 0) {
+            inodeDetachLazyTable(d);
+            inodeSetLayout(d, INODE_LAYOUT_BLOCKS, 0);
+            return 0;
+        }
+        fs.sbDirty = 0;
+        if (__invalidateInodeMap(d) < 0) {
+            inodeDetachFreeMap(d);
+            inodeDetachLazyTable(d);
+            inodeSetLayout(d, INODE_LAYOUT_BLOCKS, 0);
+            return 0;
+        }
+
+        // Alteracoes de i-nodes ficam na cache e sao gravadas por setor no
+        // fechamento de arquivos, no sync e na desmontagem
+        if (inodeSetWriteBack(d, 1) < 0) {
+            inodeDetachFreeMap(d);
+            inodeDetachLazyTable(d);
+            inodeSetLayout(d, INODE_LAYOUT_BLOCKS, 0);
+            return 0;
+        }
+
+        // Alocacoes de blocos consultam e alteram apenas a copia em memoria
+        // do mapa de blocos livres, gravada no sync e na desmontagem. O
+        // mesmo sinal que invalida o mapa de i-nodes livres indica que o
+        // mapa de blocos no disco pode estar desatualizado
+        if (__loadBlockMap(d, &fs.sb) < 0 ||
+            (unclean && __rebuildBlockMap(d, &fs.sb) < 0)) {
+            __freeBlockMap();
+            inodeSetWriteBack(d, 0);
+            inodeDetachFreeMap(d);
+            inodeDetachLazyTable(d);
+            inodeSetLayout(d, INODE_LAYOUT_BLOCKS, 0);
             return 0;
         }
 
@@ -383,16 +934,44 @@ int myFSxMount (Disk *d, int x) {
             fdTable[i].used = 0;
             fdTable[i].inodeNumber = 0;
             fdTable[i].cursor = 0;
+            fdTable[i].inode = NULL;
         }
         openCount = 0;
+        fs.d = d;
 
         return 1;
 
     } else {
-        if (__saveSuperblock(d, &sb) < 0) {
+        // I-nodes e mapa de i-nodes livres vao para o disco antes do
+        // superbloco que declara o mapa valido
+        if (__flushAllDelayed(d) < 0 || __saveBlockMap(d, &fs.sb) < 0) {
+            return 0;
+        }
+        if (inodeSetWriteBack(d, 0) < 0) {
+            inodeSetWriteBack(d, 1);
+            return 0;
+        }
+        if (inodeDetachFreeMap(d) < 0) {
+            return 0;
+        }
+        if (!(fs.sb.flags & MYFS_FLAG_INODEMAP)) {
+            fs.sb.flags |= MYFS_FLAG_INODEMAP;
+            fs.sbDirty = 1;
+        }
+
+        // O superbloco so' e' gravado se mudou desde a montagem
+        if (fs.sbDirty && __saveSuperblock(d, &fs.sb) < 0) {
             return 0;
         }
 
+        inodeCacheInvalidate(d);
+        inodeDetachLazyTable(d);
+        inodeSetLayout(d, INODE_LAYOUT_BLOCKS, 0);
+        __freeBlockMap();
+        memset(&fs.sb, 0, sizeof(Superblock));
+        fs.sbDirty = 0;
+        fs.d = NULL;
+
         return 1;
     }
 }
@@ -401,7 +980,7 @@ int myFSOpen (Disk *d, const char *path) {
     if (!d || !path) {
         return -1;
     }
-    if (sb.magic != MYFS_MAGIC) {
+    if (fs.sb.magic != MYFS_MAGIC) {
         return -1;
     }
     if (openCount >= MAX_FDS) {
@@ -414,7 +993,7 @@ int myFSOpen (Disk *d, const char *path) {
 
     if (strcmp(pathCopy, "/") == 0) return -1;
 
-    unsigned int currentInode = sb.rootInode;
+    unsigned int currentInode = fs.sb.rootInode;
     unsigned int parentInode = 0;
     
     char *token = strtok(pathCopy, "/");
@@ -433,27 +1012,40 @@ int myFSOpen (Disk *d, const char *path) {
             currentInode = nextInode;
         } else {
             if (nextToken == NULL) {
+                if (__invalidateInodeMap(d) < 0) {
+                    return -1;
+                }
                 unsigned int freeInodeNum = inodeFindFreeInode(2, d);
                 if (freeInodeNum == 0) {
                     return -1;
                 }
 
+                // Nos caminhos de falha o i-node reservado no mapa e'
+                // devolvido, para nao ficar ocupado sem estar ligado
                 Inode *newFile = inodeCreate(freeInodeNum, d);
-                if (!newFile) return -1;
+                if (!newFile) {
+                    inodeRelease(freeInodeNum, d);
+                    return -1;
+                }
 
                 inodeSetFileType(newFile, FILETYPE_REGULAR);
                 inodeSetOwner(newFile, 0);
                 inodeSetFileSize(newFile, 0);
                 
                 if (inodeSave(newFile) < 0) {
-                    free(newFile);
+                    inodePut(newFile);
+                    inodeRelease(freeInodeNum, d);
                     return -1;
                 }
-                free(newFile);
 
-                if (__addEntryToDir(d, parentInode, freeInodeNum, filename, &sb) < 0) {
+                if (__addEntryToDir(d, parentInode, freeInodeNum, filename, &fs.sb) < 0) {
+                    // O i-node ja' gravado e' esvaziado antes de ser devolvido
+                    inodeClear(newFile);
+                    inodePut(newFile);
+                    inodeRelease(freeInodeNum, d);
                     return -1;
                 }
+                inodePut(newFile);
                 
                 currentInode = freeInodeNum;
             } else {
@@ -463,14 +1055,13 @@ int myFSOpen (Disk *d, const char *path) {
         token = nextToken;
     }
 
-    Inode *targetInode = inodeLoad(currentInode, d);
+    Inode *targetInode = inodeGet(currentInode, d);
     if (!targetInode) return -1;
 
     if (inodeGetFileType(targetInode) == FILETYPE_DIR) {
-        free(targetInode);
+        inodePut(targetInode);
         return -1;
     }
-    free(targetInode);
 
     for (int i = 0; i < MAX_FDS; i++) {
         if (fdTable[i].used == 0) {
@@ -479,11 +1070,13 @@ int myFSOpen (Disk *d, const char *path) {
             fdTable[i].inodeNumber = currentInode;
             fdTable[i].cursor = 0;
             fdTable[i].d = d; 
+            fdTable[i].inode = targetInode;
             openCount++;
             return i + 1;
         }
     }
 
+    inodePut(targetInode);
     return -1;
 }
     
@@ -494,20 +1087,16 @@ int myFSRead (int fd, char *buf, unsigned int nbytes) {
     }
 
     Disk *d = fdTable[idx].d;
-    unsigned int inodeNum = fdTable[idx].inodeNumber;
 
-    Superblock sb;
-    if (__loadSuperblock(d, &sb) < 0) return -1;
+    Superblock *sb = &fs.sb;
 
-    Inode *inode = inodeLoad(inodeNum, d);
-    if (!inode) return -1;
+    Inode *inode = fdTable[idx].inode;
 
     unsigned int fileSize = inodeGetFileSize(inode);
     unsigned int cursor = fdTable[idx].cursor;
     unsigned int bytesRead = 0;
 
     if (cursor >= fileSize) {
-        free(inode);
         return 0;
     }
 
@@ -515,38 +1104,75 @@ int myFSRead (int fd, char *buf, unsigned int nbytes) {
         nbytes = fileSize - cursor;
     }
 
+    // Dados embutidos vem do proprio i-node, ja' em memoria
+    if (inodeIsInline(inode)) {
+        inodeReadInline(inode, cursor, (unsigned char*)buf, nbytes);
+        fdTable[idx].cursor = cursor + nbytes;
+        return nbytes;
+    }
+
+    // Dados ainda sem blocos estao no buffer de escrita adiada
+    MyFSDelayed *dl = __findDelayed(inode);
+
     while (bytesRead < nbytes) {
-        unsigned int logicalBlockNum = cursor / sb.blockSize;
-        unsigned int offsetInBlock = cursor % sb.blockSize;
+        unsigned int logicalBlockNum = cursor / sb->blockSize;
+        unsigned int offsetInBlock = cursor % sb->blockSize;
+
+        if (dl && cursor >= dl->start) {
+            memcpy(buf + bytesRead, dl->data + (cursor - dl->start), nbytes - bytesRead);
+            cursor += nbytes - bytesRead;
+            bytesRead = nbytes;
+            break;
+        }
         
         unsigned int physicalBlockAddr = inodeGetBlockAddr(inode, logicalBlockNum);
-        
-        unsigned char *blockBuffer = malloc(sb.blockSize);
-        
-        if (physicalBlockAddr != 0) {
-            int sectorsPerBlock = sb.blockSize / DISK_SECTORDATASIZE;
-            for (int k = 0; k < sectorsPerBlock; k++) {
-                diskReadSector(d, physicalBlockAddr + k, blockBuffer + (k * DISK_SECTORDATASIZE));
-            }
-        } else {
-            memset(blockBuffer, 0, sb.blockSize);
-        }
+        int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
 
-        unsigned int spaceInBlock = sb.blockSize - offsetInBlock;
+        unsigned int spaceInBlock = sb->blockSize - offsetInBlock;
         unsigned int toCopy = nbytes - bytesRead;
         if (toCopy > spaceInBlock) toCopy = spaceInBlock;
 
-        memcpy(buf + bytesRead, blockBuffer + offsetInBlock, toCopy);
-        
-        free(blockBuffer);
+        if (physicalBlockAddr == 0) {
+            memset(buf + bytesRead, 0, toCopy);
+        } else if (toCopy == sb->blockSize) {
+            // Blocos lidos por inteiro vao direto para o buffer do chamador,
+            // numa unica leitura para cada sequencia de blocos fisicamente
+            // contiguos
+            unsigned int run = 1;
+            while (nbytes - bytesRead >= (run + 1) * sb->blockSize) {
+                unsigned int next = cursor + run * sb->blockSize;
+                if (dl && next >= dl->start) break;
+                if (inodeGetBlockAddr(inode, logicalBlockNum + run) !=
+                    physicalBlockAddr + run * sectorsPerBlock) break;
+                run++;
+            }
+            if (diskReadSectors(d, physicalBlockAddr, (unsigned long)run * sectorsPerBlock,
+                                (unsigned char*)buf + bytesRead) < 0) break;
+            toCopy = run * sb->blockSize;
+        } else {
+            // Bloco lido em parte: so' os setores que contem o trecho pedido
+            unsigned int firstSector = offsetInBlock / DISK_SECTORDATASIZE;
+            unsigned int numSectors = (offsetInBlock + toCopy - 1) / DISK_SECTORDATASIZE
+                                      - firstSector + 1;
+            unsigned char *sectorBuffer = malloc(numSectors * DISK_SECTORDATASIZE);
+            if (!sectorBuffer) break;
+            if (diskReadSectors(d, physicalBlockAddr + firstSector, numSectors,
+                                sectorBuffer) < 0) {
+                free(sectorBuffer);
+                break;
+            }
+            memcpy(buf + bytesRead,
+                   sectorBuffer + (offsetInBlock - firstSector * DISK_SECTORDATASIZE), toCopy);
+            free(sectorBuffer);
+        }
 
         bytesRead += toCopy;
         cursor += toCopy;
     }
 
     fdTable[idx].cursor = cursor;
-    free(inode);
 
+    if (bytesRead == 0 && nbytes > 0) return -1;
     return bytesRead;
 }
 
@@ -557,65 +1183,138 @@ int myFSWrite (int fd, const char *buf, unsigned int nbytes) {
     }
 
     Disk *d = fdTable[idx].d;
-    unsigned int inodeNum = fdTable[idx].inodeNumber;
     
-    Superblock sb;
-    if (__loadSuperblock(d, &sb) < 0) {
-        return -1;
-    }
+    Superblock *sb = &fs.sb;
 
-    Inode *inode = inodeLoad(inodeNum, d);
-    if (!inode) {
-        return -1;
-    }
+    Inode *inode = fdTable[idx].inode;
 
     unsigned int bytesWritten = 0;
     unsigned int cursor = fdTable[idx].cursor;
+
+    // Arquivos pequenos ficam embutidos no i-node enquanto couberem nele; ao
+    // crescer alem disso, os dados passam para o primeiro bloco
+    int isInline = inodeIsInline(inode);
+    if (!isInline && (sb->flags & MYFS_FLAG_INLINE) &&
+        inodeGetFileSize(inode) == 0 && inodeGetBlockAddr(inode, 0) == 0) {
+        isInline = 1;
+    }
+    if (isInline && cursor + nbytes <= inodeInlineCapacity()) {
+        if (inodeWriteInline(inode, cursor, (const unsigned char*)buf, nbytes) < 0) {
+            return -1;
+        }
+        fdTable[idx].cursor = cursor + nbytes;
+        if (cursor + nbytes > inodeGetFileSize(inode)) {
+            inodeSetFileSize(inode, cursor + nbytes);
+        }
+        if (inodeSave(inode) < 0) return -1;
+        return nbytes;
+    }
+    if (inodeIsInline(inode) && __spillInline(d, inode, sb) < 0) {
+        return -1;
+    }
     
+    MyFSDelayed *dl = __findDelayed(inode);
+
+    // Escritas de blocos inteiros saem direto de buf, em segundo plano: toda
+    // saida a partir daqui passa por diskAsyncWait antes de retornar
     while (bytesWritten < nbytes) {
-        unsigned int logicalBlockNum = cursor / sb.blockSize;
-        unsigned int offsetInBlock = cursor % sb.blockSize;
+        unsigned int logicalBlockNum = cursor / sb->blockSize;
+        unsigned int offsetInBlock = cursor % sb->blockSize;
         
-        unsigned int physicalBlockAddr = inodeGetBlockAddr(inode, logicalBlockNum);
+        unsigned int physicalBlockAddr = (dl && cursor >= dl->start)
+                                         ? 0 : inodeGetBlockAddr(inode, logicalBlockNum);
 
         if (physicalBlockAddr == 0) {
-            unsigned int newBlock = __allocBlock(d, &sb);
-            if (newBlock == 0) break;
+            // Alocacao adiada: a escrita fica em memoria, e os blocos so' sao
+            // escolhidos quando o tamanho final for conhecido. O buffer e'
+            // gravado a cada MYFS_DELAYEDMAX bytes
+            if (dl && dl->len >= MYFS_DELAYEDMAX) {
+                if (__flushDelayed(d, dl) < 0) break;
+                dl = NULL;
+                continue;
+            }
 
-            if (inodeAddBlock(inode, newBlock) < 0) break;
-            
-            physicalBlockAddr = newBlock;
+            unsigned int start = (dl ? dl->start : logicalBlockNum * sb->blockSize);
+            unsigned int chunk = nbytes - bytesWritten;
+            if (chunk > MYFS_DELAYEDMAX - (cursor - start)) {
+                chunk = MYFS_DELAYEDMAX - (cursor - start);
+            }
 
-            unsigned char *cleanBuf = calloc(1, sb.blockSize);
-            int sectorsPerBlock = sb.blockSize / DISK_SECTORDATASIZE;
-            for (int k = 0; k < sectorsPerBlock; k++) 
-                diskWriteSector(d, physicalBlockAddr + k, cleanBuf + (k * DISK_SECTORDATASIZE));
-            free(cleanBuf);
+            // Sem blocos livres para reservar, a escrita termina mais curta
+            int copied = __bufferDelayed(inode, logicalBlockNum, cursor,
+                                         buf + bytesWritten, chunk);
+            if (copied <= 0) break;
+            bytesWritten += copied;
+            cursor += copied;
+            dl = __findDelayed(inode);
+            if ((unsigned int)copied < chunk) break;
+            continue;
         }
 
-        unsigned char *blockBuffer = malloc(sb.blockSize);
-        int sectorsPerBlock = sb.blockSize / DISK_SECTORDATASIZE;
+        int sectorsPerBlock = sb->blockSize / DISK_SECTORDATASIZE;
+
+        if (offsetInBlock == 0 && nbytes - bytesWritten >= sb->blockSize) {
+            // Blocos cobertos por inteiro nao precisam ser lidos: os dados
+            // vao direto do buffer do chamador, numa unica escrita para
+            // cada sequencia de blocos fisicamente contiguos
+            unsigned int run = 1;
+            while (nbytes - bytesWritten >= (run + 1) * sb->blockSize) {
+                unsigned int next = cursor + run * sb->blockSize;
+                if (dl && next >= dl->start) break;
+                if (inodeGetBlockAddr(inode, logicalBlockNum + run) !=
+                    physicalBlockAddr + run * sectorsPerBlock) break;
+                run++;
+            }
+
+            unsigned char *src = (unsigned char*)(buf + bytesWritten);
+            if (diskAsyncSubmit(d, DISK_IO_WRITE, physicalBlockAddr,
+                                (unsigned long)run * sectorsPerBlock, src, NULL, NULL) < 0 &&
+                diskWriteSectors(d, physicalBlockAddr,
+                                 (unsigned long)run * sectorsPerBlock, src) < 0) break;
 
-        for (int k = 0; k < sectorsPerBlock; k++) {
-            diskReadSector(d, physicalBlockAddr + k, blockBuffer + (k * DISK_SECTORDATASIZE));
+            bytesWritten += run * sb->blockSize;
+            cursor += run * sb->blockSize;
+            continue;
         }
 
-        unsigned int spaceInBlock = sb.blockSize - offsetInBlock;
+        unsigned int spaceInBlock = sb->blockSize - offsetInBlock;
         unsigned int toCopy = nbytes - bytesWritten;
         if (toCopy > spaceInBlock) toCopy = spaceInBlock;
 
-        memcpy(blockBuffer + offsetInBlock, buf + bytesWritten, toCopy);
-
-        for (int k = 0; k < sectorsPerBlock; k++) {
-            diskWriteSector(d, physicalBlockAddr + k, blockBuffer + (k * DISK_SECTORDATASIZE));
+        // Bloco coberto em parte: so' os setores tocados sao lidos,
+        // alterados e regravados
+        unsigned int firstSector = offsetInBlock / DISK_SECTORDATASIZE;
+        unsigned int numSectors = (offsetInBlock + toCopy - 1) / DISK_SECTORDATASIZE
+                                  - firstSector + 1;
+        unsigned char *blockBuffer = malloc(numSectors * DISK_SECTORDATASIZE);
+        if (!blockBuffer) break;
+
+        if (diskReadSectors(d, physicalBlockAddr + firstSector, numSectors, blockBuffer) < 0) {
+            free(blockBuffer);
+            break;
         }
 
-        free(blockBuffer);
+        memcpy(blockBuffer + (offsetInBlock - firstSector * DISK_SECTORDATASIZE),
+               buf + bytesWritten, toCopy);
+
+        // A escrita do bloco segue em segundo plano, sobrepondo-se as
+        // atualizacoes de bitmap e i-node dos proximos blocos
+        if (diskAsyncSubmit(d, DISK_IO_WRITE, physicalBlockAddr + firstSector, numSectors,
+                            blockBuffer, __freeOnCompletion, blockBuffer) < 0) {
+            int failed = diskWriteSectors(d, physicalBlockAddr + firstSector,
+                                          numSectors, blockBuffer) < 0;
+            free(blockBuffer);
+            if (failed) break;
+        }
 
         bytesWritten += toCopy;
         cursor += toCopy;
     }
 
+    // O tamanho do arquivo so' cresce depois que as escritas em segundo
+    // plano terminaram bem
+    if (diskAsyncWait(d) < 0) return -1;
+
     fdTable[idx].cursor = cursor;
 
     if (cursor > inodeGetFileSize(inode)) {
@@ -623,8 +1322,6 @@ int myFSWrite (int fd, const char *buf, unsigned int nbytes) {
         inodeSave(inode);
     }
 
-    free(inode);
-
     if (bytesWritten == 0 && nbytes > 0) return -1;
     return bytesWritten;
 }
@@ -640,6 +1337,24 @@ int myFSClose (int fd) {
         return -1;
     }
     
+    Disk *d = fdTable[index].d;
+
+    // Dados com alocacao adiada recebem seus blocos antes que o i-node va'
+    // para o disco. Se a gravacao falhar, o arquivo termina no ultimo bloco
+    // gravado, e o restante do buffer e' descartado junto com o descritor
+    int ret = 0;
+    MyFSDelayed *dl = __findDelayed(fdTable[index].inode);
+    if (dl && __flushDelayed(d, dl) < 0) {
+        if (inodeGetFileSize(dl->inode) > dl->start) {
+            inodeSetFileSize(dl->inode, dl->start);
+            inodeSave(dl->inode);
+        }
+        __dropDelayed(dl);
+        ret = -1;
+    }
+
+    inodePut(fdTable[index].inode);
+    fdTable[index].inode = NULL;
     fdTable[index].used = 0;
     fdTable[index].inodeNumber = 0;
     fdTable[index].cursor = 0;
@@ -649,6 +1364,71 @@ int myFSClose (int fd) {
         openCount--;
     }
 
+    // I-nodes alterados enquanto o arquivo esteve aberto vao para o disco,
+    // um setor da tabela por vez
+    if (inodeCacheFlush(d) < 0) {
+        return -1;
+    }
+
+    return ret;
+}
+
+int myFSSync (Disk *d) {
+    if (!d || d != fs.d) {
+        return -1;
+    }
+    if (__flushAllDelayed(d) < 0 || __saveBlockMap(d, &fs.sb) < 0 ||
+        inodeCacheFlush(d) < 0) {
+        return -1;
+    }
+
+    // O mapa de i-nodes livres so' vale no superbloco depois que ele esta'
+    // no disco
+    if (!(fs.sb.flags & MYFS_FLAG_INODEMAP)) {
+        fs.sb.flags |= MYFS_FLAG_INODEMAP;
+        fs.sbDirty = 1;
+    }
+    if (fs.sbDirty) {
+        if (__saveSuperblock(d, &fs.sb) < 0) {
+            return -1;
+        }
+        fs.sbDirty = 0;
+    }
+    return 0;
+}
+
+int myFSPreallocate (int fd, unsigned int nbytes) {
+    int idx = fd - 1;
+    if (idx < 0 || idx >= MAX_FDS || fdTable[idx].used == 0 || fdTable[idx].isDir == 1) {
+        return -1;
+    }
+
+    Disk *d = fdTable[idx].d;
+    Superblock *sb = &fs.sb;
+    Inode *inode = fdTable[idx].inode;
+
+    if (inodeIsInline(inode)) {
+        if (nbytes <= inodeInlineCapacity()) return 0;
+        if (__spillInline(d, inode, sb) < 0) return -1;
+    }
+
+    // Dados com alocacao adiada recebem seus blocos antes da reserva
+    MyFSDelayed *dl = __findDelayed(inode);
+    if (dl && __flushDelayed(d, dl) < 0) return -1;
+
+    // Blocos ja' alocados: os que cobrem o tamanho atual e os reservados
+    // alem dele por chamadas anteriores
+    unsigned int need = (nbytes + sb->blockSize - 1) / sb->blockSize;
+    unsigned int have = (inodeGetFileSize(inode) + sb->blockSize - 1) / sb->blockSize;
+    while (have < need && inodeGetBlockAddr(inode, have) != 0) {
+        have++;
+    }
+    if (have >= need) return 0;
+
+    int added = __extendFile(d, inode, sb, need - have, NULL);
+    if (inodeSave(inode) < 0 || added < 0 || (unsigned int)added < need - have) {
+        return -1;
+    }
     return 0;
 }
 
@@ -689,5 +1469,6 @@ int installMyFS (void) {
     fsInfo.linkFn = myFSLink;
     fsInfo.unlinkFn = myFSUnlink;
     fsInfo.closedirFn = myFSCloseDir;
+    fsInfo.preallocFn = myFSPreallocate;
     return vfsRegisterFS(&fsInfo);
 }
\ No newline at end of file
@@ -18,6 +18,16 @@
 // Constantes do sistema de arquivos MyFS
 #define MYFS_MAGIC 0x12345678
 #define MAX_INODES 1024
+#define MYFS_INODEMAP_SECTOR 1  // Setor do mapa de i-nodes livres
+
+// Opcoes de formatacao, gravadas no campo flags do superbloco
+#define MYFS_FLAG_EXTENTS 0x1   // I-nodes enderecam blocos por extents
+#define MYFS_FLAG_INODEMAP 0x2  // Mapa de i-nodes livres valido no disco
+#define MYFS_FLAG_INLINE 0x4    // Arquivos pequenos embutidos no i-node
+#define MYFS_FLAG_LAZYINODES 0x8 // Formatacao rapida: tabela de i-nodes
+                                 // inicializada sob demanda (inodeTableInit)
+#define MYFS_KNOWN_FLAGS (MYFS_FLAG_EXTENTS | MYFS_FLAG_INODEMAP | \
+                          MYFS_FLAG_INLINE | MYFS_FLAG_LAZYINODES)
 
 // Estrutura do Superbloco
 typedef struct {
@@ -28,6 +38,9 @@ typedef struct {
     unsigned int freeMapSize;
     unsigned int dataStartSector;
     unsigned int rootInode;
+    unsigned int flags;         // Opcoes de formatacao (MYFS_FLAG_*)
+    unsigned int inodeTableInit; // Setores inicializados da tabela de
+                                 // i-nodes, com MYFS_FLAG_LAZYINODES
 } Superblock;
 
 //Funcao para instalar seu sistema de arquivos no S.O., registrando-o junto
@@ -36,4 +49,19 @@ typedef struct {
 //Caso contrario, retorna -1
 int installMyFS ( void );
 
+//Funcao para formatar um disco com o MyFS, com blocos de blockSize bytes e
+//as opcoes de formatacao em flags (MYFS_FLAG_*). Retorna o numero total de
+//blocos disponiveis no disco ou -1 em caso de falha
+int myFSFormatEx (Disk *d, unsigned int blockSize, unsigned int flags);
+
+//Funcao que define as opcoes de formatacao (MYFS_FLAG_*) usadas pelas
+//proximas formatacoes feitas pelo VFS (vfsFormat). Retorna 0 se bem
+//sucedido ou -1 se houver opcoes desconhecidas
+int myFSSetFormatFlags (unsigned int flags);
+
+//Funcao que grava no disco d, montado, os i-nodes alterados e os mapas de
+//blocos e de i-nodes livres mantidos em memoria. Retorna 0 se bem sucedido
+//ou -1 caso contrario
+int myFSSync (Disk *d);
+
 #endif
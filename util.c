@@ -11,8 +11,16 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include "util.h"
 
+//Hosts little-endian guardam unsigned int na mesma ordem de bytes usada em
+//disco, e os vetores podem ser copiados diretamente
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ \
+    || defined(_WIN32)
+#define UTIL_LITTLEENDIAN 1
+#endif
+
 //Funcao para a conversao de unsigned int para um array de bytes (char[])
 //O array c deve possuir numero de elementos suficiente para abrigar um 
 //unsigned int como sequencia de bytes. Ex.: Em plataformas de 64 bits testadas
@@ -32,3 +40,30 @@ void char2ul (unsigned char *c, unsigned int *ui) {
 	for (int i = 0; i < sizeof (unsigned int); i++)
 		*ui = *ui + (c[i] << (i*8));
 }
+
+//Funcao para a conversao de um vetor de n unsigned ints para um array de bytes
+//(char[]), na mesma representacao de ul2char, um valor apos o outro
+void ul2chars (const unsigned int *ui, unsigned char *c, unsigned long n) {
+#ifdef UTIL_LITTLEENDIAN
+	memcpy (c, ui, n * sizeof (unsigned int));
+#else
+	for (unsigned long a = 0; a < n; a++)
+		for (int i = 0; i < sizeof (unsigned int); i++)
+			c[a * sizeof (unsigned int) + i] = (ui[a] >> (i*8)) & 0xFF;
+#endif
+}
+
+//Funcao para a conversao de um array de bytes (char[]) em um vetor de n
+//unsigned ints, inversa de ul2chars
+void char2uls (const unsigned char *c, unsigned int *ui, unsigned long n) {
+#ifdef UTIL_LITTLEENDIAN
+	memcpy (ui, c, n * sizeof (unsigned int));
+#else
+	for (unsigned long a = 0; a < n; a++) {
+		ui[a] = 0;
+		for (int i = 0; i < sizeof (unsigned int); i++)
+			ui[a] |= (unsigned int) c[a * sizeof (unsigned int) + i]
+			         << (i*8);
+	}
+#endif
+}
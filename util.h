@@ -26,4 +26,14 @@ void ul2char (unsigned int ui, unsigned char *c);
 //elementos de c serao considerados
 void char2ul (unsigned char *c, unsigned int *ui);
 
+//Funcao para a conversao de um vetor de n unsigned ints para um array de bytes
+//(char[]), na mesma representacao de ul2char (little-endian), um valor apos
+//o outro. O array c deve possuir n * sizeof (unsigned int) elementos. Em
+//plataformas little-endian, a conversao e' uma copia direta de memoria
+void ul2chars (const unsigned int *ui, unsigned char *c, unsigned long n);
+
+//Funcao para a conversao de um array de bytes (char[]) em um vetor de n
+//unsigned ints, inversa de ul2chars. Os arrays nao podem se sobrepor
+void char2uls (const unsigned char *c, unsigned int *ui, unsigned long n);
+
 #endif
@@ -153,6 +153,15 @@ int vfsClosedir (int fd) {
         return rootFS->closedirFn (fd);
 }
 
+//Funcao para reservar espaco para um arquivo, identificado por um descritor
+//de arquivo existente, de modo que seus primeiros nbytes bytes tenham blocos
+//alocados, sem alterar o tamanho do arquivo. Retorna 0 caso bem sucedido, ou
+//-1 caso contrario ou se o sistema de arquivos nao suportar a operacao.
+int vfsPreallocate (int fd, unsigned int nbytes) {
+        if ( !rootDisk || !rootFS || !rootFS->preallocFn ) return -1;
+        return rootFS->preallocFn (fd, nbytes);
+}
+
 //Registra novo sistema de arquivos. Retorna um identificador unico (slot),
 //caso o sistema de arquivos tenha sido registrado com sucesso. Caso contrario,
 //retorna -1
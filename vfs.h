@@ -100,6 +100,13 @@ typedef struct fs_info {
 	//arquivo existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.	
 	int (*closedirFn) (int fd);
 
+	//Funcao para reservar espaco para um arquivo, identificado por um
+	//descritor de arquivo existente, de modo que seus primeiros nbytes
+	//bytes tenham blocos alocados, sem alterar o tamanho do arquivo.
+	//Opcional (NULL se nao suportada). Retorna 0 caso bem sucedido, ou -1
+	//caso contrario.
+	int (*preallocFn) (int fd, unsigned int nbytes);
+
 } FSInfo;
 
 //Funcao para inicializacao do sistema de arquivos virtual
@@ -169,6 +176,13 @@ int vfsUnlink (int fd, const char *filename);
 //existente. Retorna 0 caso bem sucedido, ou -1 caso contrario.
 int vfsClosedir (int fd);
 
+//Funcao para reservar espaco para um arquivo, identificado por um descritor
+//de arquivo existente, de modo que seus primeiros nbytes bytes tenham blocos
+//alocados, sem alterar o tamanho do arquivo (como fallocate). Retorna 0 caso
+//bem sucedido, ou -1 caso contrario ou se o sistema de arquivos nao suportar
+//a operacao.
+int vfsPreallocate (int fd, unsigned int nbytes);
+
 //Registra novo sistema de arquivos. Retorna um identificador unico (slot),
 //caso o sistema de arquivos tenha sido registrado com sucesso. Caso contrario,
 //retorna -1